@@ -0,0 +1,17 @@
+#ifndef AES_H
+#define AES_H
+
+#include <stdint.h>
+
+#define AES_BLOCK_SIZE 16
+#define AES_KEY_SIZE 16
+
+/**
+ * Chiffre un bloc avec AES-128 (clés de tour calculées à la volée, sans table en RAM)
+ * @param key : clé de 16 octets
+ * @param in : bloc clair de 16 octets
+ * @param out : bloc chiffré de 16 octets (peut être égal à in)
+ */
+void aes128_encrypt(const uint8_t* key, const uint8_t* in, uint8_t* out);
+
+#endif // AES_H
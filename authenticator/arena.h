@@ -0,0 +1,69 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include "consts.h"
+
+// Memoire de travail des commandes. Une seule commande s'en sert a la fois (les
+// commandes servies pendant qu'une demande attend le bouton n'y touchent pas),
+// les structures des commandes se recouvrent donc dans une union.
+// Les champs de la requete sont en tete, dans l'ordre du protocole: main.c les
+// lit d'un seul read_bytes_with_timeout (*_REQUEST_SIZE octets).
+
+// MAKE_CREDENTIAL, ADD_CREDENTIAL
+typedef struct {
+    uint8_t app_id[SHA1_APP_ID_SIZE]; // requete
+    uint8_t credential_id[CREDENTIAL_ID_SIZE];
+    uint8_t public_key[PUBLIC_KEY_SIZE];
+    uint8_t private_key[PRIVATE_KEY_SIZE];
+} MakeCredentialArena;
+
+// MAKE_WRAPPED_CREDENTIAL
+typedef struct {
+    uint8_t app_id[SHA1_APP_ID_SIZE]; // requete
+    uint8_t wrapped_credential_id[WRAPPED_CREDENTIAL_ID_SIZE];
+    uint8_t public_key[PUBLIC_KEY_SIZE];
+    uint8_t private_key[PRIVATE_KEY_SIZE];
+} MakeWrappedCredentialArena;
+
+// GET_ASSERTION, GET_ASSERTION_ALLOW (la liste est lue id par id a cote)
+typedef struct {
+    uint8_t app_id[SHA1_APP_ID_SIZE];         // requete
+    uint8_t challenge[CLIENT_DATA_HASH_SIZE]; // requete
+    uint8_t credential_id[CREDENTIAL_ID_SIZE];
+    uint8_t private_key[PRIVATE_KEY_SIZE];
+    uint8_t signature[SIGNATURE_SIZE];
+} GetAssertionArena;
+
+// GET_WRAPPED_ASSERTION
+typedef struct {
+    uint8_t app_id[SHA1_APP_ID_SIZE];                          // requete
+    uint8_t challenge[CLIENT_DATA_HASH_SIZE];                  // requete
+    uint8_t wrapped_credential_id[WRAPPED_CREDENTIAL_ID_SIZE]; // requete
+    uint8_t private_key[PRIVATE_KEY_SIZE];
+    uint8_t signature[SIGNATURE_SIZE];
+} GetWrappedAssertionArena;
+
+// GET_ASSERTION_BATCH: chaque paire (app_id, clientDataHash) est signee en place
+typedef struct {
+    uint8_t requests[GET_ASSERTION_BATCH_MAX][SHA1_APP_ID_SIZE + CLIENT_DATA_HASH_SIZE]; // requete
+    uint8_t credential_id[CREDENTIAL_ID_SIZE];
+    uint8_t private_key[PRIVATE_KEY_SIZE];
+    uint8_t signature[SIGNATURE_SIZE];
+} GetAssertionBatchArena;
+
+typedef union {
+    MakeCredentialArena make;
+    MakeWrappedCredentialArena make_wrapped;
+    GetAssertionArena assertion;
+    GetWrappedAssertionArena wrapped_assertion;
+    GetAssertionBatchArena batch;
+} CommandArena;
+
+#define MAKE_CREDENTIAL_REQUEST_SIZE SHA1_APP_ID_SIZE
+#define GET_ASSERTION_REQUEST_SIZE (SHA1_APP_ID_SIZE + CLIENT_DATA_HASH_SIZE)
+#define GET_WRAPPED_ASSERTION_REQUEST_SIZE (GET_ASSERTION_REQUEST_SIZE + WRAPPED_CREDENTIAL_ID_SIZE)
+
+extern CommandArena arena;
+
+#endif // ARENA_H
@@ -0,0 +1,35 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "clock.h"
+
+// Timer1 en mode normal, prescaler 64: 4 us par pas a 16 MHz et un debordement
+// toutes les 262 ms, soit moins de 4 reveils par seconde au repos
+#define CLOCK_US_PER_TICK 4
+
+static volatile uint16_t clock_overflows = 0; // 16 bits de poids fort du compteur
+
+ISR(TIMER1_OVF_vect) {
+    clock_overflows++;
+}
+
+void clock_init(void) {
+    TCCR1A = 0;
+    TCNT1 = 0;
+    TIFR1 = (1 << TOV1);
+    TIMSK1 = (1 << TOIE1);
+    TCCR1B = (1 << CS11) | (1 << CS10);
+}
+
+uint32_t clock_us(void) {
+    uint8_t sreg = SREG;
+    cli();
+    uint16_t ticks = TCNT1;
+    uint16_t high = clock_overflows;
+    // debordement arrive mais pas encore compte par l'ISR
+    if ((TIFR1 & (1 << TOV1)) && ticks < 0x8000) {
+        high++;
+    }
+    SREG = sreg;
+    return ((((uint32_t)high) << 16) | ticks) * CLOCK_US_PER_TICK;
+}
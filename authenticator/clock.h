@@ -0,0 +1,14 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+// Horloge monotone en microsecondes sur le timer1 (pas de 4 us), qui tourne
+// des clock_init. Elle revient a 0 toutes les 71 minutes: seules les
+// differences entre deux lectures ont un sens.
+void clock_init(void);
+
+// Lisible depuis une ISR
+uint32_t clock_us(void);
+
+#endif // CLOCK_H
@@ -1,18 +1,36 @@
 #include <stdio.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "commands.h"
 #include "uart.h"
-#include "ring_buffer.h"
 #include "consts.h"
 #include "ui.h"
 #include "rng.h"
 #include "storage.h"
+#include "keywrap.h"
+#include "frame.h"
+#include "trace.h"
+#include "stats.h"
 #include "micro-ecc/uECC.h"
-#include "globals.h"
+#include "arena.h"
 
+CommandArena arena;
 
+// les champs d'une requete se suivent en memoire (lus d'un coup par main.c)
+_Static_assert(offsetof(GetAssertionArena, challenge) == SHA1_APP_ID_SIZE, "GetAssertionArena");
+_Static_assert(offsetof(GetWrappedAssertionArena, wrapped_credential_id) == GET_ASSERTION_REQUEST_SIZE,
+               "GetWrappedAssertionArena");
+
+
+// En v2 les arguments viennent de la trame deja recue et verifiee
 uint8_t read_bytes_with_timeout(uint8_t* buffer, uint8_t length, uint16_t timeout_ms) {
+    if (frame_active()) {
+        return frame_read(buffer, length);
+    }
+
     uint8_t bytes_read = 0;
+    ui_timeout_begin();
     uint16_t start_ms = ui_get_ms();
 
     while (bytes_read < length) {
@@ -20,17 +38,23 @@ uint8_t read_bytes_with_timeout(uint8_t* buffer, uint8_t length, uint16_t timeou
         uint16_t elapsed = now_ms - start_ms;
 
         if (elapsed >= timeout_ms) {
-            return 0;
+            break;
         }
 
-        uint8_t data;
-        if (UART__getbyte(&data) == 0) {
-            buffer[bytes_read++] = data;
+        // tout ce qui est deja recu du champ est copie d'un coup
+        uint8_t count = UART__read(buffer + bytes_read, length - bytes_read);
+        if (count) {
+            bytes_read += count;
             start_ms = now_ms;
+            continue;
         }
         ui_sleep_tick(now_ms);  // reutilise le timer0 qui incremente tick dans ui.c
     }
-    return 1;
+    ui_timeout_end();
+    if (bytes_read != length) {
+        stats_rx_timeout();
+    }
+    return bytes_read == length;
 }
 
 // static uint8_t read_bytes_with_timeout(uint8_t* buffer, uint8_t length, uint16_t timeout_ms) {
@@ -52,108 +76,693 @@ uint8_t read_bytes_with_timeout(uint8_t* buffer, uint8_t length, uint16_t timeou
 // }
 
 
+// le prochain octet envoye est le statut d'une reponse (compte par stats)
+static uint8_t reply_status_next = 0;
+
+void commands_begin(uint8_t cmd) {
+    stats_command(cmd);
+    reply_status_next = 1;
+}
+
 void send_byte(uint8_t data) {
-    UART__putbyte(data);
+    if (reply_status_next) {
+        reply_status_next = 0;
+        stats_status(data);
+    }
+    if (frame_active()) {
+        frame_put(data);
+    } else {
+        UART__putbyte(data);
+    }
 }
 
 void send_bytes(const uint8_t* data, uint16_t len) {
     for (uint16_t i = 0; i < len; i++) {
-        UART__putbyte(data[i]);
+        send_byte(data[i]);
     }
 }
 
+// entiers en big endian
+static void send_u16(uint16_t value) {
+    send_byte((uint8_t)(value >> 8));
+    send_byte((uint8_t)value);
+}
+
+static void send_u32(uint32_t value) {
+    send_byte((uint8_t)(value >> 24));
+    send_byte((uint8_t)(value >> 16));
+    send_byte((uint8_t)(value >> 8));
+    send_byte((uint8_t)value);
+}
+
 
-static void count_cb(uint8_t* cred_id, uint8_t* app_hash, void* data) {
-    (void)cred_id; (void)app_hash;
-    uint8_t* count_ptr = (uint8_t*)data;
-    (*count_ptr)++;
+// OPTION_COMPRESSED_KEYS
+static uint8_t compressed_keys = 0;
+
+// cle publique de la reponse, compressee si le client l'a demande
+static void send_public_key(const uint8_t* public_key) {
+    if (compressed_keys) {
+        uint8_t compressed[COMPRESSED_PUBLIC_KEY_SIZE];
+        uECC_compress(public_key, compressed, uECC_secp160r1());
+        send_bytes(compressed, COMPRESSED_PUBLIC_KEY_SIZE);
+    } else {
+        send_bytes(public_key, PUBLIC_KEY_SIZE);
+    }
 }
 
+
 static void send_cb(uint8_t* cred_id, uint8_t* app_hash, void* data) {
     (void)data;
     send_bytes(cred_id, CREDENTIAL_ID_SIZE);
     send_bytes(app_hash, SHA1_APP_ID_SIZE);
 }
 
+static void send_page_cb(uint8_t* cred_id, uint8_t* app_hash, void* data) {
+    send_byte(LIST_PAGE_ENTRY);
+    send_cb(cred_id, app_hash, data);
+}
 
-// gestion des commandes
 
-void handle_make_credential(void) {
-    // Consentement
-    if (!ui_wait_for_consent()) {
-        // MakeCredentialError
-        send_byte(STATUS_ERR_APPROVAL);
-        return;
+// Le calcul crypto est lance pendant la demande de consentement (led qui
+// clignote), puis on attend la reponse de l'utilisateur: le resultat n'est
+// rendu que si le bouton est appuye, sinon les cles calculees sont oubliees.
+static uint8_t consent_finish(uint8_t granted, uint8_t status) {
+    if (!granted) {
+        memset(&arena, 0, sizeof(arena));
+        return STATUS_ERR_APPROVAL;
+    }
+    return status;
+}
+
+// Fenetre de presence (OPTION_PRESENCE_WINDOW): apres un appui, les assertions
+// suivantes pour le meme app_id passent sans appui pendant presence_seconds,
+// au plus presence_max_uses fois
+static uint8_t presence_seconds = 0;
+static uint8_t presence_max_uses = 0;
+static uint8_t presence_uses_left = 0;
+static uint8_t presence_app_id[SHA1_APP_ID_SIZE];
+
+// @return 1 (et consomme un usage) si la fenetre couvre app_id
+static uint8_t presence_take(const uint8_t* app_id) {
+    if (!ui_presence_active() || presence_uses_left == 0 ||
+        memcmp(presence_app_id, app_id, SHA1_APP_ID_SIZE) != 0) {
+        return 0;
+    }
+    if (--presence_uses_left == 0) {
+        ui_presence_close();
+    }
+    return 1;
+}
+
+// appui confirme pour app_id: ouvre la fenetre si elle est configuree
+static void presence_grant(const uint8_t* app_id) {
+    if (presence_seconds == 0 || presence_max_uses == 0) return;
+    memcpy(presence_app_id, app_id, SHA1_APP_ID_SIZE);
+    presence_uses_left = presence_max_uses;
+    ui_presence_open(presence_seconds);
+}
+
+static void presence_clear(void) {
+    presence_uses_left = 0;
+    ui_presence_close();
+}
+
+// Demande en attente du bouton: son calcul est deja fait et la boucle
+// principale continue de servir les commandes en lecture seule. Quand l'ISR
+// timer0 a tranche (ou sur CANCEL), commands_resume envoie la reponse avec
+// <parked>. L'arena reste a la demande d'ici la.
+static void (*parked)(uint8_t status) = NULL;
+static uint8_t parked_status;   // resultat du calcul lance avec la demande
+static const uint8_t* parked_presence; // app_id dont un appui ouvre la fenetre de presence
+static uint8_t parked_framed;
+static uint8_t parked_id;       // requete v2 a laquelle repondre
+
+// met la commande en cours en attente, ui_consent_begin deja appele
+static void park(void (*finish)(uint8_t status), uint8_t status, const uint8_t* presence) {
+    parked = finish;
+    parked_status = status;
+    parked_presence = presence;
+    parked_framed = frame_active();
+    if (parked_framed) {
+        parked_id = frame_suspend();
+    }
+}
+
+uint8_t commands_pending(void) {
+    return parked != NULL;
+}
+
+void commands_resume(void) {
+    uint8_t state = ui_consent_poll();
+    if (parked == NULL || state == UI_CONSENT_PENDING) return;
+
+    void (*finish)(uint8_t status) = parked;
+    parked = NULL;
+    trace_record(TRACE_CONSENT, state);
+    uint8_t status = consent_finish(state == UI_CONSENT_GRANTED, parked_status);
+    if (status == STATUS_OK && parked_presence) {
+        presence_grant(parked_presence);
+    }
+    ui_consent_done();
+    if (parked_framed) {
+        frame_resume(parked_id);
+    }
+    reply_status_next = 1;
+    finish(status);
+    frame_end();
+}
+
+// Tirages de micro-ecc quand tout passe du premier coup (voir uECC.c): cle
+// privee et Z initial de la multiplication pour uECC_make_key, k, Z initial
+// et masquage de l'inverse pour uECC_sign. Le reste est compte en retries.
+#define UECC_RNG_CALLS_MAKE_KEY 2
+#define UECC_RNG_CALLS_SIGN 3
+
+static uint8_t uecc_rng_calls;
+
+static int uecc_rng(uint8_t* dest, unsigned size) {
+    uecc_rng_calls++;
+    return rng_generate(dest, size);
+}
+
+static void uecc_rng_begin(void) {
+    uecc_rng_calls = 0;
+    uECC_set_rng(uecc_rng);
+}
+
+static void uecc_rng_end(uint8_t expected) {
+    if (uecc_rng_calls > expected) {
+        stats_uecc_retries(uecc_rng_calls - expected);
     }
-    // generer cles
-    uECC_set_rng(rng_generate);
-    if (!uECC_make_key(public_key, private_key, uECC_secp160r1())) {
+}
+
+static uint8_t compute_key(uint8_t* public_key, uint8_t* private_key) {
+    uecc_rng_begin();
+    uint8_t status = uECC_make_key(public_key, private_key, uECC_secp160r1()) ? STATUS_OK : STATUS_ERR_CRYPTO_FAILED;
+    uecc_rng_end(UECC_RNG_CALLS_MAKE_KEY);
+    return status;
+}
+
+// Paire de cles calculee d'avance par commands_precompute_key, utilisee une
+// seule fois
+static uint8_t spare_ready = 0;
+static uint8_t spare_public_key[PUBLIC_KEY_SIZE];
+static uint8_t spare_private_key[PRIVATE_KEY_SIZE];
+
+uint8_t commands_precompute_key(void) {
+    // pas pendant une demande: le calcul retarderait sa reponse au bouton
+    if (spare_ready || parked != NULL) return 0;
+    spare_ready = compute_key(spare_public_key, spare_private_key) == STATUS_OK;
+    return 0;
+}
+
+// generer cles
+static uint8_t make_key(uint8_t* public_key, uint8_t* private_key) {
+    uint8_t status = STATUS_OK;
+    if (spare_ready) {
+        memcpy(public_key, spare_public_key, PUBLIC_KEY_SIZE);
+        memcpy(private_key, spare_private_key, PRIVATE_KEY_SIZE);
+        memset(spare_private_key, 0, PRIVATE_KEY_SIZE);
+        spare_ready = 0;
+    } else {
+        status = compute_key(public_key, private_key);
+    }
+    trace_record(TRACE_CRYPTO_DONE, status);
+    return status;
+}
+
+// Signer challenge avec private_key, qui est effacee ensuite
+static uint8_t sign_challenge(uint8_t* private_key, const uint8_t* challenge, uint8_t* signature) {
+    uecc_rng_begin();
+    uint8_t ok = uECC_sign(private_key, challenge, CLIENT_DATA_HASH_SIZE, signature, uECC_secp160r1());
+    uecc_rng_end(UECC_RNG_CALLS_SIGN);
+    memset(private_key, 0, PRIVATE_KEY_SIZE);
+    uint8_t status = ok ? STATUS_OK : STATUS_ERR_CRYPTO_FAILED;
+    trace_record(TRACE_CRYPTO_DONE, status);
+    return status;
+}
+
+
+// gestion des commandes
+
+static uint8_t (*make_save)(const uint8_t*, const uint8_t*, const uint8_t*);
+
+static void make_credential_finish(uint8_t status) {
+    MakeCredentialArena* a = &arena.make;
+
+    if (status != STATUS_OK) {
         // MakeCredentialError
-        send_byte(STATUS_ERR_CRYPTO_FAILED);
+        send_byte(status);
         return;
     }
-    // generer le credential id
-    rng_generate(credential_id, CREDENTIAL_ID_SIZE);
     // sauvegarde dans l'eeprom le sha1 app_id, cred id et clé privee
-    if (!storage_save(buffer_app_id, credential_id, private_key)) {
+    uint8_t saved = make_save(a->app_id, a->credential_id, a->private_key);
+    memset(a->private_key, 0, PRIVATE_KEY_SIZE);
+    if (!saved) {
         // MakeCredentialError
         send_byte(STATUS_ERR_STORAGE_FULL);
         return;
     }
     // MakeCredentialResponse:
     send_byte(STATUS_OK);
+    send_bytes(a->credential_id, CREDENTIAL_ID_SIZE);
+    send_public_key(a->public_key);
+}
+
+static void make_credential(uint8_t (*save)(const uint8_t*, const uint8_t*, const uint8_t*)) {
+    MakeCredentialArena* a = &arena.make;
+
+    trace_record(TRACE_ARGS_COMPLETE, 0);
+    ui_consent_begin();
+    uint8_t status = make_key(a->public_key, a->private_key);
+    if (status == STATUS_OK) {
+        // generer le credential id
+        rng_generate(a->credential_id, CREDENTIAL_ID_SIZE);
+    }
+    make_save = save;
+    park(make_credential_finish, status, NULL);
+}
+
+// remplace le credential existant de l'app_id
+void handle_make_credential(void) {
+    make_credential(storage_save);
+}
+
+// un credential de plus pour l'app_id (plusieurs comptes sur un meme site)
+void handle_add_credential(void) {
+    make_credential(storage_add);
+}
+
+
+// Le compteur de signatures n'avance qu'une fois l'assertion accordee: une
+// demande refusee, annulee ou expiree n'use pas de valeur. La signature ne le
+// couvre pas, elle peut donc etre calculee avant.
+static void send_assertion_result(const uint8_t* credential_id, const uint8_t* signature, uint32_t counter) {
     send_bytes(credential_id, CREDENTIAL_ID_SIZE);
-    send_bytes(public_key, PUBLIC_KEY_SIZE);
+    send_bytes(signature, SIGNATURE_SIZE);
+    send_u32(counter);
+}
+
+// Signe avec private_key apres consentement: fenetre de presence ouverte pour
+// app_id (reponse immediate), sinon appui bouton (la signature se calcule
+// pendant que la demande attend)
+static void sign_with_consent(const uint8_t* app_id, uint8_t* private_key, const uint8_t* challenge,
+                              uint8_t* signature, void (*finish)(uint8_t status)) {
+    if (presence_take(app_id)) {
+        finish(sign_challenge(private_key, challenge, signature));
+        return;
+    }
+    ui_consent_begin();
+    park(finish, sign_challenge(private_key, challenge, signature), app_id);
+}
+
+static void get_assertion_finish(uint8_t status) {
+    if (status != STATUS_OK) {
+        // GetAssertionError
+        send_byte(status);
+        return;
+    }
+    uint32_t counter = storage_counter_next();
+    // GetAssertionResponse:
+    send_byte(STATUS_OK);
+    send_assertion_result(arena.assertion.credential_id, arena.assertion.signature, counter);
 }
 
+// signe avec la cle trouvee, credential_id deja rempli
+static void send_assertion(void) {
+    GetAssertionArena* a = &arena.assertion;
+    sign_with_consent(a->app_id, a->private_key, a->challenge, a->signature, get_assertion_finish);
+}
 
 void handle_get_assertion(void) {
+    GetAssertionArena* a = &arena.assertion;
+
+    trace_record(TRACE_ARGS_COMPLETE, 0);
     // Chercher la clé
-    if (!storage_find_key(buffer_app_id, private_key, credential_id)) {
+    if (!storage_find_key(a->app_id, a->private_key, a->credential_id)) {
         // GetAssertionError
         send_byte(STATUS_ERR_NOT_FOUND);
         return;
     }
+    send_assertion();
+}
+
+// Les <count> credential ids sont lus un par un et cherches des leur arrivee:
+// le premier connu pour l'app_id est utilise, la liste n'est pas gardee en RAM.
+// Une liste trop longue est lue quand meme pour ne pas laisser d'octets sur l'UART.
+void handle_get_assertion_allow(uint8_t count) {
+    GetAssertionArena* a = &arena.assertion;
+    uint8_t status = (count > ALLOW_LIST_MAX) ? STATUS_ERR_BAD_PARAMETER : STATUS_ERR_NOT_FOUND;
 
-    // Attendre consentement
-    if (!ui_wait_for_consent()) {
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t allowed_id[CREDENTIAL_ID_SIZE];
+        if (read_bytes_with_timeout(allowed_id, CREDENTIAL_ID_SIZE, 1000) == 0) {
+            status = STATUS_ERR_BAD_PARAMETER;
+            break;
+        }
+        if (status == STATUS_ERR_NOT_FOUND && storage_find_credential(a->app_id, allowed_id, a->private_key)) {
+            memcpy(a->credential_id, allowed_id, CREDENTIAL_ID_SIZE);
+            status = STATUS_OK;
+        }
+    }
+    trace_record(TRACE_ARGS_COMPLETE, 0);
+    if (status != STATUS_OK) {
+        memset(a->private_key, 0, PRIVATE_KEY_SIZE);
         // GetAssertionError
-        send_byte(STATUS_ERR_APPROVAL);
+        send_byte(status);
         return;
     }
+    send_assertion();
+}
+
+
+static uint8_t batch_count;
 
-    // Signer
-    uECC_set_rng(rng_generate);
-    if (!uECC_sign(private_key, buffer_challenge, CLIENT_DATA_HASH_SIZE, signature, uECC_secp160r1())) {
+static void get_assertion_batch_finish(uint8_t status) {
+    GetAssertionBatchArena* a = &arena.batch;
+
+    if (status != STATUS_OK) {
         // GetAssertionError
-        send_byte(STATUS_ERR_CRYPTO_FAILED);
+        send_byte(status);
         return;
     }
 
-    // GetAssertionResponse:
+    // GetAssertionBatchResponse: puis <count> resultats
     send_byte(STATUS_OK);
-    send_bytes(credential_id, CREDENTIAL_ID_SIZE);
-    send_bytes(signature, SIGNATURE_SIZE);
+    send_byte(batch_count);
+    for (uint8_t i = 0; i < batch_count; i++) {
+        status = STATUS_ERR_NOT_FOUND;
+
+        if (storage_find_key(a->requests[i], a->private_key, a->credential_id)) {
+            status = sign_challenge(a->private_key, a->requests[i] + SHA1_APP_ID_SIZE, a->signature);
+        }
+        if (status == STATUS_OK) {
+            uint32_t counter = storage_counter_next();
+            send_byte(status);
+            send_assertion_result(a->credential_id, a->signature, counter);
+        } else {
+            send_byte(status);
+        }
+    }
 }
 
+// Un seul consentement pour <count> assertions: les paires sont gardees dans
+// l'arena (le buffer de reception de l'UART ne les contiendrait pas pendant
+// l'attente du bouton), puis chaque resultat est envoye des qu'il est calcule.
+void handle_get_assertion_batch(uint8_t count) {
+    if (count == 0 || count > GET_ASSERTION_BATCH_MAX) {
+        // GetAssertionError
+        send_byte(STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
+    if (read_bytes_with_timeout(arena.batch.requests[0], count * sizeof(arena.batch.requests[0]), 1000) == 0) {
+        // GetAssertionError
+        send_byte(STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
+
+    trace_record(TRACE_ARGS_COMPLETE, 0);
+    ui_consent_begin();
+    batch_count = count;
+    park(get_assertion_batch_finish, STATUS_OK, NULL);
+}
 
-void handle_list_credentials(void) {
-    uint8_t count = 0;
-    storage_iterate(count_cb, &count);
 
-    // ListCredentialsResponse:
+// Credential emballe: rien n'est ecrit en EEPROM, la cle privee voyage
+// chiffree dans le credential id
+static void make_wrapped_credential_finish(uint8_t status) {
+    if (status != STATUS_OK) {
+        // MakeCredentialError
+        send_byte(status);
+        return;
+    }
+    // MakeWrappedCredentialResponse:
     send_byte(STATUS_OK);
-    send_byte(count);
+    send_bytes(arena.make_wrapped.wrapped_credential_id, WRAPPED_CREDENTIAL_ID_SIZE);
+    send_public_key(arena.make_wrapped.public_key);
+}
+
+void handle_make_wrapped_credential(void) {
+    MakeWrappedCredentialArena* a = &arena.make_wrapped;
+
+    trace_record(TRACE_ARGS_COMPLETE, 0);
+    ui_consent_begin();
+    uint8_t status = make_key(a->public_key, a->private_key);
+    if (status == STATUS_OK) {
+        keywrap_wrap(a->app_id, a->private_key, a->wrapped_credential_id);
+        memset(a->private_key, 0, PRIVATE_KEY_SIZE);
+    }
+    park(make_wrapped_credential_finish, status, NULL);
+}
+
+
+static void get_wrapped_assertion_finish(uint8_t status) {
+    if (status != STATUS_OK) {
+        // GetAssertionError
+        send_byte(status);
+        return;
+    }
+    uint32_t counter = storage_counter_next();
+    // GetWrappedAssertionResponse:
+    send_byte(STATUS_OK);
+    send_bytes(arena.wrapped_assertion.signature, SIGNATURE_SIZE);
+    send_u32(counter);
+}
+
+void handle_get_wrapped_assertion(void) {
+    GetWrappedAssertionArena* a = &arena.wrapped_assertion;
+
+    trace_record(TRACE_ARGS_COMPLETE, 0);
+    // Deballer la clé: tag invalide = credential d'un autre device, app_id ou avant RESET
+    if (!keywrap_unwrap(a->app_id, a->wrapped_credential_id, a->private_key)) {
+        // GetAssertionError
+        send_byte(STATUS_ERR_NOT_FOUND);
+        return;
+    }
+    sign_with_consent(a->app_id, a->private_key, a->challenge, a->signature, get_wrapped_assertion_finish);
+}
+
+
+void handle_list_credentials(void) {
+    // ListCredentialsResponse: le nombre est tenu a jour en RAM, une seule passe
+    send_byte(STATUS_OK);
+    send_byte(storage_count());
     storage_iterate(send_cb, NULL);
 }
 
-void handle_reset(void) {
-    if (!ui_wait_for_consent()) {
+// Les entrees sont envoyees au fil du parcours, chacune precedee d'un marqueur:
+// le nombre filtre n'est connu qu'a la fin
+void handle_list_credentials_page(uint8_t cursor, uint8_t page_size, uint8_t prefix_len) {
+    uint8_t prefix[SHA1_APP_ID_SIZE];
+    // page vide refusee: le curseur n'avancerait jamais
+    uint8_t status = (prefix_len > SHA1_APP_ID_SIZE || page_size == 0) ? STATUS_ERR_BAD_PARAMETER : STATUS_OK;
+
+    // un prefixe trop long est lu quand meme pour ne pas laisser d'octets sur l'UART
+    for (uint8_t i = 0; i < prefix_len; i++) {
+        uint8_t byte;
+        if (read_bytes_with_timeout(&byte, 1, 1000) == 0) {
+            status = STATUS_ERR_BAD_PARAMETER;
+            break;
+        }
+        if (i < SHA1_APP_ID_SIZE) {
+            prefix[i] = byte;
+        }
+    }
+    if (status != STATUS_OK) {
+        // ListCredentialsError
+        send_byte(status);
+        return;
+    }
+
+    // ListCredentialsPageResponse:
+    send_byte(STATUS_OK);
+    cursor = storage_iterate_page(cursor, page_size, prefix, prefix_len, send_page_cb, NULL);
+    send_byte(LIST_PAGE_END);
+    send_byte(cursor);
+}
+
+static void reset_finish(uint8_t status) {
+    if (status != STATUS_OK) {
         // ResetError
-        send_byte(STATUS_ERR_APPROVAL);
+        send_byte(status);
         return;
     }
     storage_reset();
+    keywrap_rotate();
+    presence_clear();
     // ResetResponse:
     send_byte(STATUS_OK);
 }
+
+void handle_reset(void) {
+    ui_consent_begin();
+    park(reset_finish, STATUS_OK, NULL);
+}
+
+// La demande en attente recoit STATUS_ERR_APPROVAL avant la reponse de CANCEL
+void handle_cancel(void) {
+    uint8_t cancelled = 0;
+
+    if (parked != NULL) {
+        uint8_t framed = frame_active();
+        uint8_t id = framed ? frame_suspend() : 0;
+        cancelled = ui_consent_cancel();
+        commands_resume();
+        if (framed) {
+            frame_resume(id);
+        }
+    }
+    // CancelResponse: (STATUS_ERR_NOT_FOUND: rien n'attendait le bouton)
+    reply_status_next = 1;
+    send_byte(cancelled ? STATUS_OK : STATUS_ERR_NOT_FOUND);
+}
+
+// Les evenements envoyes sont retires du journal: chaque GET_TRACE rend ceux
+// arrives depuis le precedent (les 16 derniers au plus)
+void handle_get_trace(void) {
+    TraceEntry entry;
+    uint8_t count = trace_count();
+
+    // GetTraceResponse: <count> evenements du plus ancien au plus recent
+    send_byte(STATUS_OK);
+    send_byte(count);
+    for (uint8_t i = 0; i < count; i++) {
+        // un evenement arrive pendant l'envoi peut ecraser le plus ancien: il
+        // y en a toujours au moins <count>
+        trace_pop(&entry);
+        send_byte(entry.event);
+        send_byte(entry.arg);
+        send_u32(entry.time_us);
+    }
+}
+
+void handle_get_stats(void) {
+    Stats stats;
+    stats_snapshot(&stats);
+
+    // GetStatsResponse: compteurs en big endian, les tableaux precedes de leur taille
+    send_byte(STATUS_OK);
+    send_byte(STATS_OPCODES);
+    for (uint8_t i = 0; i < STATS_OPCODES; i++) {
+        send_u16(stats.commands[i]);
+    }
+    send_byte(STATS_STATUSES);
+    for (uint8_t i = 0; i < STATS_STATUSES; i++) {
+        send_u16(stats.statuses[i]);
+    }
+    send_u16(stats.rx_overflows);
+    send_u16(stats.rx_timeouts);
+    send_u16(stats.consent_timeouts);
+    send_u16(stats.uecc_retries);
+    send_u32(stats.storage_bytes);
+    send_u32(stats.rng_bytes);
+}
+
+void handle_info(void) {
+    // InfoResponse:
+    send_byte(STATUS_OK);
+    send_byte(INFO_PROTOCOL_VERSION);
+    send_byte(parked != NULL ? INFO_STATE_CONSENT : INFO_STATE_IDLE);
+    send_byte(storage_count());
+    send_byte(storage_capacity());
+    // options perdues au redemarrage: le client les relit ici plutot que de
+    // se fier a ce qu'il a demande
+    send_byte(compressed_keys ? INFO_OPTION_COMPRESSED_KEYS : 0);
+}
+
+void handle_scrub_status(void) {
+    // ScrubStatusResponse: nb de slots dont la cle reste a effacer apres un RESET
+    send_byte(STATUS_OK);
+    send_byte(storage_scrub_remaining());
+}
+
+static const uint32_t baud_rates[] = {115200UL, 250000UL, 500000UL, 1000000UL};
+
+// SetBaudResponse est envoye a l'ancien debit, puis le client doit envoyer
+// BAUD_PROBE au nouveau debit dans les BAUD_PROBE_TIMEOUT_MS. Sans probe valide
+// le device revient a l'ancien debit: un client qui n'a pas recu l'echo du probe
+// attend la fin du delai et reprend a l'ancien debit.
+void handle_set_baud(uint8_t code) {
+    uint32_t old_baud = UART__get_baud();
+    uint8_t probe = 0;
+
+    if (code >= sizeof(baud_rates) / sizeof(baud_rates[0])) {
+        // SetBaudError
+        send_byte(STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
+
+    // SetBaudResponse: (derniere trame en v2, le probe n'est jamais encadre)
+    send_byte(STATUS_OK);
+    frame_end();
+    UART__flush();
+    UART__set_baud(baud_rates[code]);
+    UART__clear_rx();
+
+    if (read_bytes_with_timeout(&probe, 1, BAUD_PROBE_TIMEOUT_MS) && probe == BAUD_PROBE) {
+        send_byte(BAUD_PROBE);
+        return;
+    }
+    UART__set_baud(old_baud);
+    UART__clear_rx();
+}
+
+// reglage de la fenetre de presence en attente du bouton
+static uint8_t pending_presence_seconds;
+static uint8_t pending_presence_max_uses;
+
+static void set_presence_window(uint8_t seconds, uint8_t max_uses) {
+    presence_seconds = seconds;
+    presence_max_uses = max_uses;
+    // une fenetre deja ouverte ne survit pas a un changement de reglage
+    presence_clear();
+}
+
+static void set_presence_window_finish(uint8_t status) {
+    if (status == STATUS_OK) {
+        set_presence_window(pending_presence_seconds, pending_presence_max_uses);
+    }
+    // SetOptionResponse / SetOptionError
+    send_byte(status);
+}
+
+void handle_set_option(uint8_t option, uint16_t value) {
+    switch (option) {
+        case OPTION_PRESENCE_WINDOW: {
+            uint8_t seconds = (uint8_t)(value >> 8);
+            uint8_t max_uses = (uint8_t)value;
+            if (seconds > PRESENCE_WINDOW_MAX_SECONDS || max_uses > PRESENCE_WINDOW_MAX_USES) {
+                // SetOptionError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+                return;
+            }
+            // une fenetre plus longue ou avec plus d'usages: l'utilisateur doit
+            // confirmer, sinon n'importe quel programme de l'hote pourrait signer
+            // sans appui apres le suivant
+            if (seconds && max_uses && (seconds > presence_seconds || max_uses > presence_max_uses ||
+                                        presence_seconds == 0 || presence_max_uses == 0)) {
+                pending_presence_seconds = seconds;
+                pending_presence_max_uses = max_uses;
+                ui_consent_begin();
+                park(set_presence_window_finish, STATUS_OK, NULL);
+                return;
+            }
+            set_presence_window(seconds, max_uses);
+            break;
+        }
+        case OPTION_COMPRESSED_KEYS:
+            if (value > 1) {
+                // SetOptionError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+                return;
+            }
+            compressed_keys = (uint8_t)value;
+            break;
+        default:
+            // SetOptionError
+            send_byte(STATUS_ERR_BAD_PARAMETER);
+            return;
+    }
+    // SetOptionResponse:
+    send_byte(STATUS_OK);
+}
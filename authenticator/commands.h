@@ -5,8 +5,38 @@
 
 void handle_make_credential(void);
 void handle_get_assertion(void);
+void handle_add_credential(void);
+void handle_get_assertion_allow(uint8_t count);
+void handle_get_assertion_batch(uint8_t count);
+void handle_make_wrapped_credential(void);
+void handle_get_wrapped_assertion(void);
 void handle_list_credentials(void);
+void handle_list_credentials_page(uint8_t cursor, uint8_t page_size, uint8_t prefix_len);
 void handle_reset(void);
+void handle_scrub_status(void);
+void handle_set_baud(uint8_t code);
+void handle_set_option(uint8_t option, uint16_t value);
+void handle_cancel(void);
+void handle_info(void);
+void handle_get_trace(void);
+void handle_get_stats(void);
+
+// Compte la commande <cmd> dans stats, et le statut de sa reponse
+void commands_begin(uint8_t cmd);
+
+// Les commandes qui demandent le bouton rendent la main des que leur calcul est
+// lance: la reponse est envoyee plus tard par commands_resume.
+// @return 1 si une commande attend le consentement
+uint8_t commands_pending(void);
+
+// Envoie la reponse de la commande en attente si l'utilisateur a tranche
+void commands_resume(void);
+
+// Calcule d'avance la paire de cles du prochain MAKE_CREDENTIAL (tache de
+// fond, un uECC_make_key d'un bloc)
+// @return 0: rien a faire ensuite
+uint8_t commands_precompute_key(void);
+
 void send_byte(uint8_t data);
 void send_bytes(const uint8_t* data, uint16_t len);
 uint8_t read_bytes_with_timeout(uint8_t* buffer, uint8_t length, uint16_t timeout_ms);
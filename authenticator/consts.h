@@ -8,6 +8,19 @@
 #define COMMAND_MAKE_CREDENTIAL 0x01
 #define COMMAND_GET_ASSERTION 0x02
 #define COMMAND_RESET 0x03
+#define COMMAND_SCRUB_STATUS 0x04
+#define COMMAND_MAKE_WRAPPED_CREDENTIAL 0x05
+#define COMMAND_GET_WRAPPED_ASSERTION 0x06
+#define COMMAND_GET_ASSERTION_ALLOW 0x07
+#define COMMAND_ADD_CREDENTIAL 0x08
+#define COMMAND_LIST_CREDENTIALS_PAGE 0x09
+#define COMMAND_SET_BAUD 0x0A
+#define COMMAND_GET_ASSERTION_BATCH 0x0B
+#define COMMAND_SET_OPTION 0x0C
+#define COMMAND_CANCEL 0x0D
+#define COMMAND_INFO 0x0E
+#define COMMAND_GET_TRACE 0x0F
+#define COMMAND_GET_STATS 0x10
 
 // types de status
 #define STATUS_OK 0x00
@@ -17,18 +30,69 @@
 #define STATUS_ERR_NOT_FOUND 0x04
 #define STATUS_ERR_STORAGE_FULL 0x05
 #define STATUS_ERR_APPROVAL 0x06
+#define STATUS_ERR_BAD_FRAME 0x07 // trame v2 au CRC invalide
 
 // tailles des elems dans les requetes/reponses
 #define SHA1_APP_ID_SIZE 20
 #define CREDENTIAL_ID_SIZE 16
 #define PUBLIC_KEY_SIZE 40
+#define COMPRESSED_PUBLIC_KEY_SIZE 21 // 0x02/0x03 (parite de y) + x
 #define PRIVATE_KEY_SIZE 21
 #define SIGNATURE_SIZE 40
 #define CLIENT_DATA_HASH_SIZE 20
+#define MASTER_KEY_SIZE 16
+#define WRAPPED_CREDENTIAL_ID_SIZE 49 // nonce 12 + cle chiffree 21 + tag 16
+#define ALLOW_LIST_MAX 16 // credential ids acceptes par GET_ASSERTION_ALLOW
+
+#define GET_ASSERTION_BATCH_MAX 3 // paires (app_id, clientDataHash) par GET_ASSERTION_BATCH
+
+// options de SET_OPTION (valeur sur 16 bits, perdues au redemarrage)
+// fenetre de presence: octet fort = duree en secondes (0 = desactivee),
+// octet faible = nombre max d'assertions sans nouvel appui
+// Elargir la fenetre demande un appui (comme RESET), la reduire non. Plafonds
+// fixes a la compilation, au-dela: STATUS_ERR_BAD_PARAMETER.
+#define OPTION_PRESENCE_WINDOW 0x01
+#ifndef PRESENCE_WINDOW_MAX_SECONDS
+#define PRESENCE_WINDOW_MAX_SECONDS 120
+#endif
+#ifndef PRESENCE_WINDOW_MAX_USES
+#define PRESENCE_WINDOW_MAX_USES 10
+#endif
+// cles publiques des reponses MAKE_*: 0 = x | y (40 octets), 1 = compressees (21 octets)
+#define OPTION_COMPRESSED_KEYS 0x02
+
+// debits de SET_BAUD (le device redemarre toujours a 115200)
+#define BAUD_CODE_115200 0x00
+#define BAUD_CODE_250000 0x01
+#define BAUD_CODE_500000 0x02
+#define BAUD_CODE_1000000 0x03
+#define BAUD_PROBE 0x55 // octet de test envoye puis renvoye au nouveau debit
+#define BAUD_PROBE_TIMEOUT_MS 1000
+
+// reponse de INFO
+#define INFO_PROTOCOL_VERSION 0x02 // v1 et trames v2 acceptes
+#define INFO_STATE_IDLE 0x00
+#define INFO_STATE_CONSENT 0x01    // une demande attend le bouton
+#define INFO_OPTION_COMPRESSED_KEYS 0x01 // octet d'options: OPTION_COMPRESSED_KEYS active
+
+// evenements du journal de GET_TRACE (trace.h)
+#define TRACE_RECEIVED 0x01      // opcode recu (arg: opcode)
+#define TRACE_ARGS_COMPLETE 0x02 // arguments lus
+#define TRACE_RNG_DONE 0x03      // octets aleatoires generes (un par appel du rng)
+#define TRACE_CRYPTO_DONE 0x04   // cle generee ou signature calculee (arg: statut)
+#define TRACE_CONSENT 0x05       // l'utilisateur a tranche (arg: UI_CONSENT_GRANTED/DENIED)
+#define TRACE_EEPROM_DONE 0x06   // file d'ecritures du stockage vide
+#define TRACE_TX_DONE 0x07       // dernier octet de la reponse sorti de l'UART
+
+// marqueurs de la reponse de LIST_CREDENTIALS_PAGE
+#define LIST_PAGE_ENTRY 0x01 // suivi de credential id + hash d'app_id
+#define LIST_PAGE_END 0x00   // suivi du curseur de la page suivante (0xFF: fin)
 
 // Configuration UI
 #define LED_BLINK_INTERVAL_MS 500   // 0.5 sec pour le clignotement led
 #define CONSENT_TIMEOUT_MS 10000 // 10 sec d'attente du consentement
+#define PRESENCE_LED_DUTY 16 // led faiblement allumee tant qu'une fenetre de presence est ouverte
+#define BUTTON_DEBOUNCE_MS 20 // appui stable pendant 20ms
 
 // Constantes matérielles
 #define LED_PORT PORTB
@@ -40,4 +104,10 @@
 #define BUTTON_DDR DDRD
 #define BUTTON_NUM  2 // PD2
 
+// controle de flux: sortie RTS du device, a relier au CTS de l'adaptateur serie
+// (niveau bas = pret a recevoir, comme le RTS d'un UART en RS-232 TTL)
+#define RTS_PORT PORTD
+#define RTS_DDR DDRD
+#define RTS_NUM 4 // PD4
+
 #endif // CONSTS_H
@@ -0,0 +1,144 @@
+#include <util/crc16.h>
+
+#include "frame.h"
+#include "commands.h"
+#include "consts.h"
+#include "uart.h"
+#include "ui.h"
+#include "stats.h"
+
+static uint8_t frame_payload[FRAME_MAX_PAYLOAD];
+static uint8_t frame_len = 0;
+static uint8_t frame_pos = 0;
+static uint8_t frame_id = 0;
+static uint8_t frame_is_active = 0;
+
+static uint8_t reply_chunk[FRAME_CHUNK_SIZE];
+static uint8_t reply_len = 0;
+
+static uint16_t frame_crc(uint16_t crc, const uint8_t* data, uint8_t len) {
+    for (uint8_t i = 0; i < len; i++) {
+        crc = _crc_ccitt_update(crc, data[i]);
+    }
+    return crc;
+}
+
+static void frame_send(uint8_t flags) {
+    uint8_t head[3] = {reply_len, frame_id, flags};
+    uint16_t crc = frame_crc(0xFFFF, head, sizeof(head));
+    crc = frame_crc(crc, reply_chunk, reply_len);
+
+    UART__putbyte(FRAME_SYNC);
+    for (uint8_t i = 0; i < sizeof(head); i++) {
+        UART__putbyte(head[i]);
+    }
+    for (uint8_t i = 0; i < reply_len; i++) {
+        UART__putbyte(reply_chunk[i]);
+    }
+    UART__putbyte((uint8_t)(crc >> 8));
+    UART__putbyte((uint8_t)crc);
+    reply_len = 0;
+}
+
+// Apres une trame invalide, ses octets restants ne doivent pas etre pris pour
+// des opcodes v1: tout est jete jusqu'au prochain SYNC ou jusqu'a un silence
+// de FRAME_BYTE_TIMEOUT_MS.
+// @return 1 si un SYNC a ete lu (debut de la trame suivante)
+static uint8_t frame_resync(void) {
+    uint8_t found = 0;
+    uint8_t byte;
+
+    ui_timeout_begin();
+    uint16_t last_ms = ui_get_ms();
+    while (!found) {
+        uint16_t now_ms = ui_get_ms();
+        if (UART__getbyte(&byte) == 0) {
+            found = byte == FRAME_SYNC;
+            last_ms = now_ms;
+        } else if ((uint16_t)(now_ms - last_ms) >= FRAME_BYTE_TIMEOUT_MS) {
+            break;
+        } else {
+            ui_sleep_tick(now_ms);
+        }
+    }
+    ui_timeout_end();
+    return found;
+}
+
+// @return 0 si la trame est invalide, sans se recaler
+static uint8_t frame_receive_one(uint8_t* opcode) {
+    uint8_t head[2]; // LEN, REQ_ID
+    uint8_t crc_bytes[2];
+
+    if (read_bytes_with_timeout(head, sizeof(head), FRAME_BYTE_TIMEOUT_MS) == 0 ||
+        head[0] == 0 || head[0] > FRAME_MAX_PAYLOAD ||
+        read_bytes_with_timeout(frame_payload, head[0], FRAME_BYTE_TIMEOUT_MS) == 0 ||
+        read_bytes_with_timeout(crc_bytes, sizeof(crc_bytes), FRAME_BYTE_TIMEOUT_MS) == 0) {
+        // trame tronquee, LEN invalide ou SYNC parasite
+        return 0;
+    }
+
+    frame_id = head[1];
+    uint16_t crc = frame_crc(frame_crc(0xFFFF, head, sizeof(head)), frame_payload, head[0]);
+    if (crc != (((uint16_t)crc_bytes[0] << 8) | crc_bytes[1])) {
+        stats_status(STATUS_ERR_BAD_FRAME);
+        reply_chunk[0] = STATUS_ERR_BAD_FRAME;
+        reply_len = 1;
+        frame_send(0);
+        return 0;
+    }
+
+    frame_len = head[0];
+    frame_pos = 1;
+    frame_is_active = 1;
+    reply_len = 0;
+    *opcode = frame_payload[0];
+    return 1;
+}
+
+uint8_t frame_receive(uint8_t* opcode) {
+    do {
+        if (frame_receive_one(opcode)) {
+            return 1;
+        }
+    } while (frame_resync());
+    return 0;
+}
+
+uint8_t frame_active(void) {
+    return frame_is_active;
+}
+
+uint8_t frame_read(uint8_t* buffer, uint8_t length) {
+    if (frame_len - frame_pos < length) {
+        return 0;
+    }
+    for (uint8_t i = 0; i < length; i++) {
+        buffer[i] = frame_payload[frame_pos++];
+    }
+    return 1;
+}
+
+void frame_put(uint8_t data) {
+    if (reply_len == FRAME_CHUNK_SIZE) {
+        frame_send(FRAME_FLAG_MORE);
+    }
+    reply_chunk[reply_len++] = data;
+}
+
+uint8_t frame_suspend(void) {
+    frame_is_active = 0;
+    return frame_id;
+}
+
+void frame_resume(uint8_t id) {
+    frame_id = id;
+    frame_is_active = 1;
+    reply_len = 0;
+}
+
+void frame_end(void) {
+    if (!frame_is_active) return;
+    frame_send(0);
+    frame_is_active = 0;
+}
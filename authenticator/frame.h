@@ -0,0 +1,52 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+// Protocole v2: chaque requete est une trame
+//   SYNC | LEN | REQ_ID | payload[LEN] | CRC16 (big endian)
+// ou le payload est l'opcode suivi des memes champs qu'en v1. Chaque reponse
+// est envoyee en une ou plusieurs trames
+//   SYNC | LEN | REQ_ID | FLAGS | payload[LEN] | CRC16
+// FRAME_FLAG_MORE indiquant que d'autres trames suivent pour la meme requete.
+// Le CRC (CRC-16/CCITT de avr-libc, init 0xFFFF) porte sur tout sauf SYNC.
+// Une requete v1 commence par un opcode, jamais egal a FRAME_SYNC.
+#define FRAME_SYNC 0xA5
+#define FRAME_MAX_PAYLOAD 128 // requete la plus longue acceptee en v2
+#define FRAME_CHUNK_SIZE 64   // payload maximal d'une trame de reponse
+#define FRAME_FLAG_MORE 0x01
+#define FRAME_BYTE_TIMEOUT_MS 50 // silence au milieu d'une trame = trame perdue
+
+// Lit la suite d'une trame dont l'octet SYNC vient d'etre recu.
+// Si le CRC est bon, la trame devient la source des lectures de
+// read_bytes_with_timeout et la destination de send_byte jusqu'a frame_end.
+// Sinon repond STATUS_ERR_BAD_FRAME (si la trame est arrivee en entier), puis
+// jette les octets suivants jusqu'a un SYNC (trame suivante, lue a son tour)
+// ou un silence de FRAME_BYTE_TIMEOUT_MS: rien n'est execute comme requete v1.
+// @return 1 et l'opcode dans *opcode si une trame valide a ete lue, 0 sinon
+uint8_t frame_receive(uint8_t* opcode);
+
+// @return 1 si une trame v2 est en cours de traitement
+uint8_t frame_active(void);
+
+// Copie <length> octets du payload de la trame courante
+// @return 0 s'il n'en reste pas assez
+uint8_t frame_read(uint8_t* buffer, uint8_t length);
+
+// Ajoute un octet a la reponse, envoye par trames de FRAME_CHUNK_SIZE
+void frame_put(uint8_t data);
+
+// Met la reponse de la trame courante de cote sans rien envoyer: send_byte
+// ecrit de nouveau sur l'UART en v1 et d'autres trames peuvent etre traitees.
+// @return l'id de la requete, pour frame_resume
+uint8_t frame_suspend(void);
+
+// Reprend la reponse a la requete <id> mise de cote par frame_suspend. Les
+// lectures continuent dans le payload de la derniere trame recue.
+void frame_resume(uint8_t id);
+
+// Envoie la derniere trame de la reponse et revient au protocole v1 (sans
+// effet si aucune trame n'est en cours)
+void frame_end(void);
+
+#endif // FRAME_H
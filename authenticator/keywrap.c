@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include "keywrap.h"
+#include "aes.h"
+#include "rng.h"
+#include "storage.h"
+
+#define KEYWRAP_CT_OFFSET KEYWRAP_NONCE_SIZE
+#define KEYWRAP_TAG_OFFSET (KEYWRAP_NONCE_SIZE + PRIVATE_KEY_SIZE)
+
+// etiquettes de derivation des sous-cles
+#define KEYWRAP_LABEL_ENC 0x01
+#define KEYWRAP_LABEL_MAC 0x02
+
+static uint8_t master_key[AES_KEY_SIZE];
+
+void keywrap_init(void) {
+    if (!storage_load_master_key(master_key)) {
+        rng_generate(master_key, AES_KEY_SIZE);
+        storage_save_master_key(master_key);
+    }
+}
+
+void keywrap_rotate(void) {
+    rng_generate(master_key, AES_KEY_SIZE);
+    storage_save_master_key(master_key);
+}
+
+// sous-cle = AES_maitre(label | epoch | 0...). L'epoch ne fait que 6 bits et
+// revient apres 64 RESET: c'est le changement de cle maitre (keywrap_rotate)
+// qui revoque les credentials emballes
+static void keywrap_derive(uint8_t label, uint8_t* key_out) {
+    uint8_t block[AES_BLOCK_SIZE] = {0};
+    block[0] = label;
+    block[1] = storage_epoch();
+    aes128_encrypt(master_key, block, key_out);
+}
+
+// chiffrement/dechiffrement CTR, compteur = nonce | 00 00 00 i
+static void keywrap_ctr(const uint8_t* key, const uint8_t* nonce, const uint8_t* in, uint8_t* out, uint8_t len) {
+    uint8_t counter[AES_BLOCK_SIZE] = {0};
+    uint8_t stream[AES_BLOCK_SIZE];
+
+    memcpy(counter, nonce, KEYWRAP_NONCE_SIZE);
+    for (uint8_t i = 0; i < len; i++) {
+        if ((i % AES_BLOCK_SIZE) == 0) {
+            counter[AES_BLOCK_SIZE - 1] = i / AES_BLOCK_SIZE;
+            aes128_encrypt(key, counter, stream);
+        }
+        out[i] = in[i] ^ stream[i % AES_BLOCK_SIZE];
+    }
+    memset(stream, 0, sizeof(stream));
+}
+
+// doublement dans GF(2^128) pour les sous-cles CMAC
+static void keywrap_dbl(uint8_t* block) {
+    uint8_t carry = block[0] & 0x80;
+    for (uint8_t i = 0; i < AES_BLOCK_SIZE - 1; i++) {
+        block[i] = (uint8_t)(block[i] << 1) | (block[i + 1] >> 7);
+    }
+    block[AES_BLOCK_SIZE - 1] = (uint8_t)(block[AES_BLOCK_SIZE - 1] << 1) ^ (carry ? 0x87 : 0x00);
+}
+
+// AES-CMAC (RFC 4493)
+static void keywrap_cmac(const uint8_t* key, const uint8_t* data, uint8_t len, uint8_t* tag_out) {
+    uint8_t subkey[AES_BLOCK_SIZE] = {0};
+    uint8_t mac[AES_BLOCK_SIZE] = {0};
+    uint8_t last = (len == 0) ? 0 : (uint8_t)((len - 1) / AES_BLOCK_SIZE);
+
+    // K1, puis K2 si le dernier bloc est incomplet
+    aes128_encrypt(key, subkey, subkey);
+    keywrap_dbl(subkey);
+    uint8_t last_len = len - last * AES_BLOCK_SIZE;
+    if (last_len != AES_BLOCK_SIZE) {
+        keywrap_dbl(subkey);
+    }
+
+    for (uint8_t b = 0; b <= last; b++) {
+        for (uint8_t i = 0; i < AES_BLOCK_SIZE; i++) {
+            uint8_t pos = b * AES_BLOCK_SIZE + i;
+            if (b != last) {
+                mac[i] ^= data[pos];
+            } else if (i < last_len) {
+                mac[i] ^= data[pos] ^ subkey[i];
+            } else {
+                mac[i] ^= ((i == last_len) ? 0x80 : 0x00) ^ subkey[i];
+            }
+        }
+        aes128_encrypt(key, mac, mac);
+    }
+    memcpy(tag_out, mac, AES_BLOCK_SIZE);
+    memset(subkey, 0, sizeof(subkey));
+}
+
+// tag = CMAC(app_id_hash | nonce | cle chiffree)
+static void keywrap_tag(const uint8_t* app_id_hash, const uint8_t* blob, uint8_t* tag_out) {
+    uint8_t mac_key[AES_KEY_SIZE];
+    uint8_t data[SHA1_APP_ID_SIZE + KEYWRAP_TAG_OFFSET];
+
+    memcpy(data, app_id_hash, SHA1_APP_ID_SIZE);
+    memcpy(data + SHA1_APP_ID_SIZE, blob, KEYWRAP_TAG_OFFSET);
+    keywrap_derive(KEYWRAP_LABEL_MAC, mac_key);
+    keywrap_cmac(mac_key, data, sizeof(data), tag_out);
+    memset(mac_key, 0, sizeof(mac_key));
+}
+
+void keywrap_wrap(const uint8_t* app_id_hash, const uint8_t* priv_key, uint8_t* blob_out) {
+    uint8_t enc_key[AES_KEY_SIZE];
+
+    rng_generate(blob_out, KEYWRAP_NONCE_SIZE);
+    keywrap_derive(KEYWRAP_LABEL_ENC, enc_key);
+    keywrap_ctr(enc_key, blob_out, priv_key, blob_out + KEYWRAP_CT_OFFSET, PRIVATE_KEY_SIZE);
+    memset(enc_key, 0, sizeof(enc_key));
+
+    keywrap_tag(app_id_hash, blob_out, blob_out + KEYWRAP_TAG_OFFSET);
+}
+
+uint8_t keywrap_unwrap(const uint8_t* app_id_hash, const uint8_t* blob, uint8_t* priv_key_out) {
+    uint8_t tag[KEYWRAP_TAG_SIZE];
+    uint8_t enc_key[AES_KEY_SIZE];
+    uint8_t diff = 0;
+
+    // comparaison en temps constant
+    keywrap_tag(app_id_hash, blob, tag);
+    for (uint8_t i = 0; i < KEYWRAP_TAG_SIZE; i++) {
+        diff |= tag[i] ^ blob[KEYWRAP_TAG_OFFSET + i];
+    }
+    if (diff != 0) {
+        return 0;
+    }
+
+    keywrap_derive(KEYWRAP_LABEL_ENC, enc_key);
+    keywrap_ctr(enc_key, blob, blob + KEYWRAP_CT_OFFSET, priv_key_out, PRIVATE_KEY_SIZE);
+    memset(enc_key, 0, sizeof(enc_key));
+    return 1;
+}
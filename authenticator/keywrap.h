@@ -0,0 +1,38 @@
+#ifndef KEYWRAP_H
+#define KEYWRAP_H
+
+#include <stdint.h>
+#include "consts.h"
+
+// Credential "sans etat": la cle privee est chiffree (AES-128-CTR) et
+// authentifiee avec le sha1 de l'app_id (AES-CMAC) sous la cle maitre du device.
+// Format: nonce (12) | cle privee chiffree (21) | tag (16)
+#define KEYWRAP_NONCE_SIZE 12
+#define KEYWRAP_TAG_SIZE 16
+
+/**
+ * Charge la cle maitre, ou la genere au premier demarrage
+ */
+void keywrap_init(void);
+
+/**
+ * Remplace la cle maitre par une nouvelle (RESET): tous les credentials
+ * emballes jusque-la deviennent invalides
+ */
+void keywrap_rotate(void);
+
+/**
+ * Emballe une cle privee pour un app_id
+ * @param app_id_hash : sha1 de l'app_id (authentifie, non stocke)
+ * @param priv_key : cle privee de PRIVATE_KEY_SIZE octets
+ * @param blob_out : credential id de WRAPPED_CREDENTIAL_ID_SIZE octets
+ */
+void keywrap_wrap(const uint8_t* app_id_hash, const uint8_t* priv_key, uint8_t* blob_out);
+
+/**
+ * Deballe un credential id produit par keywrap_wrap
+ * @return 1 si le tag est valide pour cet app_id et la cle maitre courante, 0 sinon
+ */
+uint8_t keywrap_unwrap(const uint8_t* app_id_hash, const uint8_t* blob, uint8_t* priv_key_out);
+
+#endif // KEYWRAP_H
@@ -4,64 +4,248 @@
 #include "consts.h"
 #include "ui.h"
 #include "rng.h"
-#include "globals.h"
+#include "arena.h"
 #include "commands.h"
+#include "storage.h"
+#include "keywrap.h"
+#include "frame.h"
+#include "clock.h"
+#include "trace.h"
+#include "tasks.h"
+
+
+// Commandes servies pendant qu'une demande attend le bouton: elles ne touchent
+// pas a l'arena de la demande en attente
+static uint8_t command_is_read_only(uint8_t cmd) {
+    switch (cmd) {
+        case COMMAND_LIST_CREDENTIALS:
+        case COMMAND_LIST_CREDENTIALS_PAGE:
+        case COMMAND_SCRUB_STATUS:
+        case COMMAND_CANCEL:
+        case COMMAND_INFO:
+        case COMMAND_GET_TRACE:
+        case COMMAND_GET_STATS:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void dispatch(uint8_t cmd) {
+    switch (cmd) {
+
+        case COMMAND_MAKE_CREDENTIAL: {
+            if (read_bytes_with_timeout(arena.make.app_id, MAKE_CREDENTIAL_REQUEST_SIZE, 1000) == 0) {
+                // MakeCredentialError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_make_credential();
+            }
+            break;
+        }
+
+        case COMMAND_GET_ASSERTION: {
+            if (read_bytes_with_timeout(arena.assertion.app_id, GET_ASSERTION_REQUEST_SIZE, 1000) == 0) {
+                // GetAssertionError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_get_assertion();
+            }
+            break;
+        }
+
+        case COMMAND_ADD_CREDENTIAL: {
+            if (read_bytes_with_timeout(arena.make.app_id, MAKE_CREDENTIAL_REQUEST_SIZE, 1000) == 0) {
+                // MakeCredentialError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_add_credential();
+            }
+            break;
+        }
+
+        case COMMAND_GET_ASSERTION_ALLOW: {
+            uint8_t count;
+            if (read_bytes_with_timeout(arena.assertion.app_id, GET_ASSERTION_REQUEST_SIZE, 1000) == 0 ||
+                read_bytes_with_timeout(&count, 1, 1000) == 0) {
+                // GetAssertionError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_get_assertion_allow(count);
+            }
+            break;
+        }
+
+        case COMMAND_GET_ASSERTION_BATCH: {
+            uint8_t count;
+            if (read_bytes_with_timeout(&count, 1, 1000) == 0) {
+                // GetAssertionError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_get_assertion_batch(count);
+            }
+            break;
+        }
+
+        case COMMAND_MAKE_WRAPPED_CREDENTIAL: {
+            if (read_bytes_with_timeout(arena.make_wrapped.app_id, MAKE_CREDENTIAL_REQUEST_SIZE, 1000) == 0) {
+                // MakeCredentialError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_make_wrapped_credential();
+            }
+            break;
+        }
+
+        case COMMAND_GET_WRAPPED_ASSERTION: {
+            if (read_bytes_with_timeout(arena.wrapped_assertion.app_id, GET_WRAPPED_ASSERTION_REQUEST_SIZE, 1000) == 0) {
+                // GetAssertionError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_get_wrapped_assertion();
+            }
+            break;
+        }
+
+        case COMMAND_LIST_CREDENTIALS: {
+            handle_list_credentials();
+            break;
+        }
+
+        case COMMAND_LIST_CREDENTIALS_PAGE: {
+            uint8_t args[3]; // curseur, taille de page, taille du prefixe
+            if (read_bytes_with_timeout(args, sizeof(args), 1000) == 0) {
+                // ListCredentialsError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_list_credentials_page(args[0], args[1], args[2]);
+            }
+            break;
+        }
+
+        case COMMAND_SET_BAUD: {
+            uint8_t code;
+            if (read_bytes_with_timeout(&code, 1, 1000) == 0) {
+                // SetBaudError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_set_baud(code);
+            }
+            break;
+        }
+
+        case COMMAND_SET_OPTION: {
+            uint8_t args[3]; // option, valeur (big endian)
+            if (read_bytes_with_timeout(args, sizeof(args), 1000) == 0) {
+                // SetOptionError
+                send_byte(STATUS_ERR_BAD_PARAMETER);
+            } else {
+                handle_set_option(args[0], ((uint16_t)args[1] << 8) | args[2]);
+            }
+            break;
+        }
+
+        case COMMAND_RESET: {
+            handle_reset();
+            break;
+        }
+
+        case COMMAND_SCRUB_STATUS: {
+            handle_scrub_status();
+            break;
+        }
+
+        case COMMAND_CANCEL: {
+            handle_cancel();
+            break;
+        }
+
+        case COMMAND_INFO: {
+            handle_info();
+            break;
+        }
+
+        case COMMAND_GET_TRACE: {
+            handle_get_trace();
+            break;
+        }
+
+        case COMMAND_GET_STATS: {
+            handle_get_stats();
+            break;
+        }
+
+        default: {
+            send_byte(STATUS_ERR_COMMAND_UNKNOWN);
+            break;
+        }
+    }
+}
 
 
 int main(void) {
+    clock_init();
     UART__init();
     ui_init();
     //rng_set_method(RNG_METHOD_ADC); // tester plusieurs
     rng_init(); // defaut init methode combinee
-    //storage_init();
+    storage_init();
+    keywrap_init();
     set_sleep_mode(SLEEP_MODE_IDLE);
 
-    while (1) {
-        uint8_t cmd;
-
-        if (UART__getbyte(&cmd) == 0) {
-            switch (cmd) {
-
-                case COMMAND_MAKE_CREDENTIAL: {
-                    if (read_bytes_with_timeout(buffer_app_id, SHA1_APP_ID_SIZE, 1000) == 0) {
-                        // MakeCredentialError
-                        send_byte(STATUS_ERR_BAD_PARAMETER);
-                    } else {
-                        handle_make_credential();
-                    }
-                    break;
-                }
-
-                case COMMAND_GET_ASSERTION: {
-                    if (read_bytes_with_timeout(buffer_app_id, SHA1_APP_ID_SIZE, 1000) == 0 ||
-                        read_bytes_with_timeout(buffer_challenge, CLIENT_DATA_HASH_SIZE, 1000) == 0) {
-                        // GetAssertionError
-                        send_byte(STATUS_ERR_BAD_PARAMETER);
-                    } else {
-                        handle_get_assertion();
-                    }
-                    break;
-                }
+    uint8_t cmd;
+    uint8_t has_cmd = 0; // commande recue mais pas encore traitee
+    uint8_t cmd_framed = 0;
+    uint8_t cmd_id = 0;
+    uint8_t storage_was_busy = 0;
 
-                case COMMAND_LIST_CREDENTIALS: {
-                    handle_list_credentials();
-                    break;
-                }
+    while (1) {
+        // reponse de la demande en attente des que le bouton (ou le timeout) a tranche
+        commands_resume();
 
-                case COMMAND_RESET: {
-                    handle_reset();
-                    break;
-                }
+        uint8_t storage_is_busy = storage_busy();
+        if (storage_was_busy && !storage_is_busy) {
+            trace_record(TRACE_EEPROM_DONE, 0);
+        }
+        storage_was_busy = storage_is_busy;
 
-                default: {
-                    send_byte(STATUS_ERR_COMMAND_UNKNOWN);
-                    break;
+        if (!has_cmd) {
+            if (UART__getbyte(&cmd) != 0) {
+                // une tranche de taches de fond, et on dort quand elles n'ont plus
+                // rien a faire en attendant des donnees (ou la fin d'une ecriture
+                // EEPROM, ou un tick pendant le consentement)
+                if (!tasks_run()) {
+                    UART__sleep();
                 }
+                continue;
             }
+            // v2: l'opcode est dans la trame, les arguments sont lus depuis la trame
+            if (cmd == FRAME_SYNC && !frame_receive(&cmd)) {
+                continue;
+            }
+            has_cmd = 1;
+            cmd_framed = frame_active();
+            trace_record(TRACE_RECEIVED, cmd);
+        }
 
-        } else {
-            UART__sleep();
+        if (commands_pending() && !command_is_read_only(cmd)) {
+            // une seule demande a la fois: la commande attend la fin de celle en
+            // cours, ses arguments restent dans l'UART (ou dans la trame) et rien
+            // d'autre n'est lu d'ici la
+            if (frame_active()) {
+                cmd_id = frame_suspend();
+            }
+            ui_sleep_tick(ui_get_ms());
+            continue;
+        }
+        if (cmd_framed && !frame_active()) {
+            frame_resume(cmd_id);
         }
+        has_cmd = 0;
+        tasks_command();
+        commands_begin(cmd);
+        dispatch(cmd);
+        frame_end();
     }
     return 0;
 }
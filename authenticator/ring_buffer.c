@@ -1,31 +1,64 @@
 #include "ring_buffer.h"
 
+// empeche le compilateur de deplacer les acces au buffer de part et d'autre
+// de la mise a jour de head/tail (l'AVR ne reordonne pas les acces memoire)
+#define RB_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
 void ring_buffer__init(struct ring_buffer* rb, uint8_t* buffer, uint8_t buffer_size){
     rb->buffer = buffer;
-    rb->maxlen = buffer_size;
+    rb->mask = buffer_size - 1;
     rb->head = 0;
     rb->tail = 0;
+    rb->overflows = 0;
+}
+
+uint8_t ring_buffer__push(struct ring_buffer* rb, uint8_t data){
+    uint8_t head = rb->head;
+    // si buffer plein, on garde les anciens octets et on compte la perte
+    if ((uint8_t)(head - rb->tail) > rb->mask) {
+        rb->overflows++;
+        return 1;
+    }
+    rb->buffer[head & rb->mask] = data;
+    RB_BARRIER();
+    rb->head = head + 1;
+    return 0;
+}
+
+uint8_t ring_buffer__available(struct ring_buffer* rb){
+    return (uint8_t)(rb->head - rb->tail);
+}
+
+uint8_t ring_buffer__full(struct ring_buffer* rb){
+    return ring_buffer__available(rb) > rb->mask;
+}
+
+uint8_t ring_buffer__empty(struct ring_buffer* rb){
+    return rb->head == rb->tail;
 }
 
-void ring_buffer__push(struct ring_buffer* rb, uint8_t data){
-    uint8_t next_head = rb->head + 1;
-    if (next_head >= rb->maxlen)
-        next_head = 0;
-    // si buffer plein, on ecrase
-    if (next_head == rb->tail){
-        uint8_t next_tail = rb->tail + 1;
-        if (next_tail >= rb->maxlen)
-            next_tail = 0;
-        rb->tail = next_tail;
+uint8_t ring_buffer__peek_n(struct ring_buffer* rb, uint8_t* data, uint8_t length){
+    uint8_t tail = rb->tail;
+    uint8_t count = ring_buffer__available(rb);
+    if (count > length) count = length;
+    RB_BARRIER();
+    for (uint8_t i = 0; i < count; i++) {
+        data[i] = rb->buffer[(uint8_t)(tail + i) & rb->mask];
     }
-    rb->buffer[rb->head] = data;
-    rb->head = next_head;
+    return count;
+}
+
+uint8_t ring_buffer__pop_n(struct ring_buffer* rb, uint8_t* data, uint8_t length){
+    uint8_t count = ring_buffer__peek_n(rb, data, length);
+    RB_BARRIER();
+    rb->tail = rb->tail + count;
+    return count;
 }
 
 uint8_t ring_buffer__pop(struct ring_buffer* rb, uint8_t* data){
-    if (rb->head == rb->tail) return 1; // buffer vide
-    *data = rb->buffer[rb->tail];
-    rb->tail++;
-    if (rb->tail >= rb->maxlen) rb->tail = 0;
-    return 0;
+    return ring_buffer__pop_n(rb, data, 1) == 1 ? 0 : 1;
+}
+
+void ring_buffer__clear(struct ring_buffer* rb){
+    rb->tail = rb->head;
 }
@@ -3,34 +3,47 @@
 
 #include <stdint.h>
 
+/*
+ * Single producer, single consumer ring buffer (e.g. an ISR and the main loop)
+ *
+ * <head> is only written by the producer and <tail> only by the consumer.
+ * Both run freely and are masked on access, so head - tail is the number of
+ * bytes stored: the capacity must be a power of two, at most 128. One byte
+ * indices are read and written atomically on the AVR, so no side needs to
+ * disable interrupts.
+ *
+ * A push on a full buffer drops the new byte and counts it in <overflows>.
+*/
 struct ring_buffer {
     uint8_t *buffer;
-    uint8_t head;
-    uint8_t tail;
-    uint8_t maxlen;
+    volatile uint8_t head;
+    volatile uint8_t tail;
+    uint8_t mask;
+    volatile uint16_t overflows;
 };
 
 /*
  * Initializes an already allocated ring_buffer struct
  * <rb>: a pointer to a ring_buffer struct
  * <buffer>: an already allocated buffer that the ring_buffer will use
- * <buffer_size>: the size of the <buffer>
+ * <buffer_size>: the size of the <buffer>, a power of two up to 128
  *
  * Remark: this can not fail
 */
 void ring_buffer__init(struct ring_buffer* rb, uint8_t* buffer, uint8_t buffer_size);
 
 /*
- * Pushes a byte in a ring buffer
+ * Pushes a byte in a ring buffer (producer side)
  * <rb>: a pointer to a ring_buffer struct
  * <data>: the byte to push
- *
- * Remark: this can not fail
+ * @return:
+ *  0 if push succeed
+ *  1 if the ring buffer is full: <data> is dropped and counted in overflows
 */
-void ring_buffer__push(struct ring_buffer* rb, uint8_t data);
+uint8_t ring_buffer__push(struct ring_buffer* rb, uint8_t data);
 
 /*
- * Pops a byte from a ring buffer
+ * Pops a byte from a ring buffer (consumer side)
  * <rb>: a pointer to a ring_buffer struct
  * <data>: the address where the byte will be written
  * @return:
@@ -39,4 +52,52 @@ void ring_buffer__push(struct ring_buffer* rb, uint8_t data);
 */
 uint8_t ring_buffer__pop(struct ring_buffer* rb, uint8_t* data);
 
+/*
+ * Number of bytes that can be popped (consumer side)
+ * <rb>: a pointer to a ring_buffer struct
+*/
+uint8_t ring_buffer__available(struct ring_buffer* rb);
+
+/*
+ * Copies up to <length> bytes without removing them (consumer side)
+ * <rb>: a pointer to a ring_buffer struct
+ * <data>: the address where the bytes will be written
+ * <length>: the maximum number of bytes to copy
+ * @return: the number of bytes copied
+*/
+uint8_t ring_buffer__peek_n(struct ring_buffer* rb, uint8_t* data, uint8_t length);
+
+/*
+ * Pops up to <length> bytes (consumer side)
+ * <rb>: a pointer to a ring_buffer struct
+ * <data>: the address where the bytes will be written
+ * <length>: the maximum number of bytes to pop
+ * @return: the number of bytes popped
+*/
+uint8_t ring_buffer__pop_n(struct ring_buffer* rb, uint8_t* data, uint8_t length);
+
+/*
+ * Drops every byte currently stored (consumer side), overflows is kept
+ * <rb>: a pointer to a ring_buffer struct
+*/
+void ring_buffer__clear(struct ring_buffer* rb);
+
+/*
+ * Tells whether a ring buffer is full (the next push would be dropped)
+ * <rb>: a pointer to a ring_buffer struct
+ * @return:
+ *  1 if the ring buffer is full
+ *  0 otherwise
+*/
+uint8_t ring_buffer__full(struct ring_buffer* rb);
+
+/*
+ * Tells whether a ring buffer is empty
+ * <rb>: a pointer to a ring_buffer struct
+ * @return:
+ *  1 if the ring buffer is empty
+ *  0 otherwise
+*/
+uint8_t ring_buffer__empty(struct ring_buffer* rb);
+
 #endif
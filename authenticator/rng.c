@@ -1,9 +1,28 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <stdint.h>
+#include <string.h>
 #include <util/delay.h>
 #include "rng.h"
-
+#include "trace.h"
+#include "stats.h"
+#include "clock.h"
+#include "consts.h"
+
+
+// Reserve d'octets remplie en tache de fond: rng_generate la vide avant de
+// generer le reste, ce qui evite quelques ms par octet aux commandes
+#ifndef RNG_POOL_SIZE
+#define RNG_POOL_SIZE 32
+#endif
+static uint8_t rng_pool[RNG_POOL_SIZE];
+static uint8_t rng_pool_len = 0;
+static uint8_t rng_method = RNG_METHOD_COMBINED;
+// Mesure en cours pour la reserve: lancee par une etape de rng_pool_refill,
+// lue par une suivante, sans attente active entre les deux
+#define RNG_POOL_SAMPLE_US 3000 // bruit du timer2 accumule par octet
+static uint8_t pool_sampling = 0;
+static uint32_t pool_sample_start;
 
 static volatile uint8_t adc_complete = 0;
 static volatile uint8_t adc_result = 0;
@@ -32,25 +51,42 @@ static int rng_adc_generate(uint8_t* buffer, unsigned int size) {
     return size;
 }
 
-// rng timer1
+// rng timer2 (le timer1 est l'horloge de clock.c), sans prescaler comme
+// l'ancien timer: la gigue est lue au cycle pres, un debordement toutes les
+// 16 us. Arrete hors de la generation, son ISR reveillerait sinon le cpu en
+// permanence
 static void rng_timer_init(void) {
-    TCCR1A = 0;
-    TCCR1B = (1 << CS10);
-    TIMSK1 = (1 << TOIE1);
-    TCNT1 = 0;
+    TCCR2A = 0;
+    TCCR2B = 0;
+    TIMSK2 = 0;
+    TCNT2 = 0;
+}
+
+static void rng_timer_start(void) {
+    TCNT2 = 0;
+    TIFR2 = (1 << TOV2);
+    TIMSK2 = (1 << TOIE2);
+    TCCR2B = (1 << CS20);
 }
 
-ISR(TIMER1_OVF_vect) {
-    timer_noise += TCNT1;
+static void rng_timer_stop(void) {
+    TCCR2B = 0;
+    TIMSK2 = 0;
+}
+
+ISR(TIMER2_OVF_vect) {
+    timer_noise += TCNT2;
 }
 
 static int rng_timer_generate(uint8_t* buffer, unsigned int size) {
+    rng_timer_start();
     for (unsigned int i = 0; i < size; i++) {
         timer_noise = 0;
-        TCNT1 = 0;
+        TCNT2 = 0;
         for (volatile uint16_t delay = 0; delay < 15000; delay++);
         buffer[i] = (uint8_t)timer_noise;
     }
+    rng_timer_stop();
     return size;
 }
 
@@ -62,6 +98,7 @@ static void rng_combined_init(void) {
 }
 
 static int rng_combined_generate(uint8_t* buffer, unsigned int size) {
+    rng_timer_start();
     for (unsigned int i = 0; i < size; i++) {
         // Byte ADC
         adc_complete = 0;
@@ -73,13 +110,14 @@ static int rng_combined_generate(uint8_t* buffer, unsigned int size) {
 
         // Byte Timer
         timer_noise = 0;
-        TCNT1 = 0;
+        TCNT2 = 0;
         for (volatile uint16_t delay = 0; delay < 8000; delay++);
         uint8_t timer_byte = (uint8_t)timer_noise;
 
         // XOR des deux
         buffer[i] = adc_byte ^ timer_byte;
     }
+    rng_timer_stop();
     return size;
 }
 
@@ -99,6 +137,13 @@ struct {
     .generate = rng_combined_generate
 };
 
+static void rng_pool_sample_abort(void) {
+    if (pool_sampling) {
+        rng_timer_stop();
+        pool_sampling = 0;
+    }
+}
+
 void rng_set_method(uint8_t method) {
     switch (method) {
         case RNG_METHOD_ADC:
@@ -116,6 +161,11 @@ void rng_set_method(uint8_t method) {
         default:
             method = RNG_METHOD_COMBINED;
     }
+    rng_method = method;
+    // la reserve vient de l'ancienne methode
+    rng_pool_sample_abort();
+    memset(rng_pool, 0, sizeof(rng_pool));
+    rng_pool_len = 0;
     rng_current.init();
 }
 
@@ -124,5 +174,60 @@ void rng_init(void) {
 }
 
 int rng_generate(uint8_t* buffer, unsigned int size) {
-    return rng_current.generate(buffer, size);
+    unsigned int taken = 0;
+
+    // les generateurs reprennent l'ADC et le timer2
+    rng_pool_sample_abort();
+    // chaque octet de la reserve ne sert qu'une fois
+    while (taken < size && rng_pool_len) {
+        rng_pool_len--;
+        buffer[taken++] = rng_pool[rng_pool_len];
+        rng_pool[rng_pool_len] = 0;
+    }
+    if (taken < size) {
+        rng_current.generate(buffer + taken, size - taken);
+    }
+    trace_record(TRACE_RNG_DONE, (uint8_t)size);
+    stats_rng_bytes(size);
+    return size;
+}
+
+// Un octet par mesure, avec les memes sources que la methode courante. Chaque
+// etape dure quelques us: la tache rend la main pendant la mesure.
+uint8_t rng_pool_refill(void) {
+    if (rng_pool_len == RNG_POOL_SIZE) return 0;
+
+    if (!pool_sampling) {
+        adc_complete = 0;
+        if (rng_method != RNG_METHOD_TIMER) {
+            ADCSRA |= (1 << ADSC);
+        }
+        rng_timer_start();
+        timer_noise = 0;
+        TCNT2 = 0;
+        pool_sample_start = clock_us();
+        pool_sampling = 1;
+        return 1;
+    }
+    if ((rng_method != RNG_METHOD_TIMER && !adc_complete) ||
+        clock_us() - pool_sample_start < RNG_POOL_SAMPLE_US) {
+        return 1;
+    }
+
+    uint8_t timer_byte = (uint8_t)timer_noise;
+    rng_timer_stop();
+    pool_sampling = 0;
+    switch (rng_method) {
+        case RNG_METHOD_ADC:
+            rng_pool[rng_pool_len] = adc_result;
+            break;
+        case RNG_METHOD_TIMER:
+            rng_pool[rng_pool_len] = timer_byte;
+            break;
+        default:
+            rng_pool[rng_pool_len] = adc_result ^ timer_byte;
+            break;
+    }
+    rng_pool_len++;
+    return rng_pool_len < RNG_POOL_SIZE;
 }
@@ -22,6 +22,13 @@ void rng_init(void);
  */
 int rng_generate(uint8_t* buffer, unsigned int size);
 
+/**
+ * Ajoute un octet à la réserve servie en premier par rng_generate
+ * (tâche de fond, voir tasks.c)
+ * @return : 1 si la réserve n'est pas encore pleine
+ */
+uint8_t rng_pool_refill(void);
+
 /**
  * Change la méthode RNG au runtime
  * @param method : RNG_METHOD_* constant
@@ -0,0 +1,55 @@
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "stats.h"
+#include "uart.h"
+
+static Stats stats;
+
+static void stats_inc(uint16_t* counter, uint16_t count) {
+    *counter = (*counter > 0xFFFF - count) ? 0xFFFF : *counter + count;
+}
+
+static void stats_inc32(uint32_t* counter, uint16_t count) {
+    *counter = (*counter > 0xFFFFFFFFUL - count) ? 0xFFFFFFFFUL : *counter + count;
+}
+
+void stats_command(uint8_t cmd) {
+    stats_inc(&stats.commands[cmd < STATS_OPCODES - 1 ? cmd : STATS_OPCODES - 1], 1);
+}
+
+void stats_status(uint8_t status) {
+    if (status < STATS_STATUSES) {
+        stats_inc(&stats.statuses[status], 1);
+    }
+}
+
+void stats_rx_timeout(void) {
+    stats_inc(&stats.rx_timeouts, 1);
+}
+
+void stats_consent_timeout(void) {
+    stats_inc(&stats.consent_timeouts, 1);
+}
+
+void stats_uecc_retries(uint8_t count) {
+    stats_inc(&stats.uecc_retries, count);
+}
+
+void stats_storage_bytes(uint8_t count) {
+    stats_inc32(&stats.storage_bytes, count);
+}
+
+void stats_rng_bytes(uint16_t count) {
+    stats_inc32(&stats.rng_bytes, count);
+}
+
+void stats_snapshot(Stats* out) {
+    // consent_timeouts et storage_bytes changent sous les ISR timer0 et EE_READY
+    uint8_t sreg = SREG;
+    cli();
+    memcpy(out, &stats, sizeof(Stats));
+    SREG = sreg;
+    out->rx_overflows = UART__rx_overflows();
+}
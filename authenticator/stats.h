@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include "consts.h"
+
+// Compteurs de fonctionnement exportes par GET_STATS. Ils sont en RAM (remis a
+// zero au demarrage) et saturent au lieu de revenir a 0.
+
+// une case par opcode, la derniere pour les opcodes inconnus
+#define STATS_OPCODES (COMMAND_GET_STATS + 2)
+// une case par statut renvoye, STATUS_OK compris
+#define STATS_STATUSES (STATUS_ERR_BAD_FRAME + 1)
+
+typedef struct {
+    uint16_t commands[STATS_OPCODES];
+    uint16_t statuses[STATS_STATUSES];
+    uint16_t rx_overflows;     // octets perdus, tampon de reception plein
+    uint16_t rx_timeouts;      // arguments v1 (ou trame) incomplets a l'expiration du delai
+    uint16_t consent_timeouts; // consentements refuses faute d'appui
+    uint16_t uecc_retries;     // tirages refaits par micro-ecc (hors intervalle ou echec)
+    uint32_t storage_bytes;    // octets programmes sur le support (EEPE lance, page flash ecrite)
+    uint32_t rng_bytes;        // octets aleatoires generes
+} Stats;
+
+void stats_command(uint8_t cmd);
+void stats_status(uint8_t status);
+void stats_rx_timeout(void);
+// appele depuis l'ISR timer0
+void stats_consent_timeout(void);
+void stats_uecc_retries(uint8_t count);
+// appele depuis l'ISR EE_READY
+void stats_storage_bytes(uint8_t count);
+void stats_rng_bytes(uint16_t count);
+
+// Copie coherente des compteurs
+void stats_snapshot(Stats* out);
+
+#endif // STATS_H
@@ -1,85 +1,563 @@
 #include "storage.h"
-#include <avr/eeprom.h>
+#include "storage_backend.h"
+#include <stddef.h>
 #include <string.h>
 
-// Calculer combien d'entrées tiennent dans 1KB (ATmega328P)
-// Taille entry ~= 1 + 20 + 16 + 21 = 58 bytes. 1024 / 58 ~= 17 entrées.
-#define MAX_ENTRIES 15
-#define ENTRY_SIZE sizeof(CredentialEntry)
+// Journal circulaire d'enregistrements, sur le support choisi a la compilation
+// (STORAGE_BACKEND, EEPROM par defaut). Disposition: en-tete, compteur de
+// signatures, puis les slots du journal jusqu'a la fin du support.
+// EEPROM 1KB: record = 2 + 1 + 20 + 16 + 20 + 1 = 60 bytes, en-tete = 18 bytes,
+// compteur = 19 bytes: (1024 - 18 - 19) / 60 = 16 slots (20 avec STORAGE_APP_HASH_SIZE=8).
+// Chaque MAKE_CREDENTIAL ajoute un record a la tete du journal avec un numero
+// de sequence croissant, le record le plus recent d'un app_id masque les anciens.
+#ifndef STORAGE_BACKEND
+#define STORAGE_BACKEND storage_backend_eeprom
+#endif
 
-EEMEM CredentialEntry eeprom_entries[MAX_ENTRIES];
+static const StorageBackend* const backend = &STORAGE_BACKEND;
 
-void storage_reset(void) {
-    // Crée un buffer de zéros de la taille d'une entrée
-    uint8_t zero_buffer[ENTRY_SIZE] = {0};
+// taille sur le support: sans le bourrage de fin que l'hote ajoute quand la
+// taille est impaire (STORAGE_APP_HASH_SIZE impair)
+#define RECORD_SIZE (offsetof(CredentialEntry, commit) + 1)
+#define BITMAP_SIZE (STORAGE_MAX_SLOTS / 8)
+
+_Static_assert(offsetof(CredentialEntry, commit) ==
+               3 + STORAGE_APP_HASH_SIZE + CREDENTIAL_ID_SIZE + PACKED_KEY_SIZE,
+               "CredentialEntry ne doit pas avoir de bourrage entre ses champs");
+
+_Static_assert(STORAGE_MAX_SLOTS % 8 == 0 && STORAGE_MAX_SLOTS <= 255,
+               "STORAGE_MAX_SLOTS doit etre un multiple de 8 inferieur a 256");
+
+// adresses sur le support
+#define HEADER_ADDR(field) offsetof(StorageHeader, field)
+#define COUNTER_ADDR(field) (sizeof(StorageHeader) + offsetof(SignCounter, field))
+#define LOG_ADDR (sizeof(StorageHeader) + sizeof(SignCounter))
+#define RECORD_ADDR(slot, field) (LOG_ADDR + (uint16_t)(slot) * RECORD_SIZE + offsetof(CredentialEntry, field))
+
+// valeurs de l'octet format de l'en-tete (a changer avec la disposition du
+// support), toute autre valeur = support a formater
+#define STORAGE_FORMAT_NO_KEY 0x73
+#define STORAGE_FORMAT_KEY 0xC4 // cle maitre complete
+
+#define META_KEY_BIT 0x80
+#define META_REPLACE_BIT 0x40 // le record masque les records plus anciens du meme app_id
+#define EPOCH_MASK 0x3F
+
+static uint8_t log_slots = 0; // slots tenant sur le support, au plus STORAGE_MAX_SLOTS
+static uint16_t queued = 0;   // octets passes au support, pour les barrieres
+
+static void st_write(const void* src, uint16_t addr, uint8_t len) {
+    backend->write(src, addr, len);
+    queued += len;
+}
+
+static void st_write_byte(uint16_t addr, uint8_t value) {
+    st_write(&value, addr, 1);
+}
+
+static void st_read(void* dst, uint16_t addr, uint8_t len) {
+    backend->read(dst, addr, len);
+}
+
+static uint8_t st_read_byte(uint16_t addr) {
+    uint8_t value;
+    st_read(&value, addr, 1);
+    return value;
+}
+
+static uint16_t st_read_word(uint16_t addr) {
+    uint16_t value;
+    st_read(&value, addr, sizeof(value));
+    return value;
+}
+
+uint8_t storage_busy(void) {
+    return backend->busy();
+}
+
+void storage_flush(void) {
+    backend->flush();
+}
+
+uint16_t storage_barrier(void) {
+    return queued;
+}
+
+uint8_t storage_committed(uint16_t ticket) {
+    return (int16_t)(backend->written() - ticket) >= 0;
+}
 
-    // Remplacer TOUS les octets de toutes les entrées par des zéros.
-    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
-        // Adresse de début de l'entrée dans l'EEPROM
-        CredentialEntry *entry_addr = &eeprom_entries[i];
+// Index en RAM construit au demarrage: des empreintes d'un octet par slot
+// (app_id et credential id) et un bitmap des records vivants, pour ne lire
+// qu'un candidat sur le support
+static uint8_t index_fingerprint[STORAGE_MAX_SLOTS];
+static uint8_t index_cred_fingerprint[STORAGE_MAX_SLOTS];
+static uint8_t index_live[BITMAP_SIZE];      // bit i = slot i contient un record vivant
+static uint8_t index_stale[BITMAP_SIZE];     // slots pouvant contenir une cle d'une ancienne generation
+static uint8_t live_count = 0;  // nombre de bits a 1 dans index_live
+static uint8_t log_head = 0;    // prochain slot a essayer pour l'ajout
+static uint16_t log_seq = 0;    // numero de sequence du prochain record
+static uint8_t current_epoch = 0;
+static uint32_t sign_counter = 0;
 
-        // Écrire le buffer de zéros sur toute la taille de l'entrée
-        eeprom_write_block(zero_buffer, entry_addr, ENTRY_SIZE);
+static uint8_t bitmap_get(const uint8_t* bitmap, uint8_t slot) {
+    return (bitmap[slot / 8] >> (slot % 8)) & 1;
+}
+
+static void bitmap_set(uint8_t* bitmap, uint8_t slot, uint8_t value) {
+    if (value) {
+        bitmap[slot / 8] |= 1 << (slot % 8);
+    } else {
+        bitmap[slot / 8] &= ~(1 << (slot % 8));
     }
 }
 
-uint8_t storage_save(const uint8_t* app_id_hash, const uint8_t* cred_id, const uint8_t* priv_key) {
-    int8_t free_slot = -1;
-    int8_t existing_slot = -1;
-
-    // Vérifier si l'app_id existe déjà (pour remplacement) ou trouver slot vide
-    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
-        uint8_t used = eeprom_read_byte(&eeprom_entries[i].used);
-        if (used == 0x01) {
-            uint8_t stored_hash[SHA1_APP_ID_SIZE];
-            eeprom_read_block(stored_hash, eeprom_entries[i].app_id_hash, SHA1_APP_ID_SIZE);
-            if (memcmp(stored_hash, app_id_hash, SHA1_APP_ID_SIZE) == 0) {
-                existing_slot = i;
-                break;
+static uint8_t bitmap_any(const uint8_t* bitmap) {
+    for (uint8_t b = 0; b < BITMAP_SIZE; b++) {
+        if (bitmap[b]) return 1;
+    }
+    return 0;
+}
+
+// le sha1 et le credential id sont uniformes, un octet suffit comme empreinte
+static uint8_t storage_fingerprint(const uint8_t* app_id_hash) {
+    return app_id_hash[0];
+}
+
+static uint8_t storage_slot_live(uint8_t slot) {
+    return bitmap_get(index_live, slot);
+}
+
+static uint8_t storage_slot_stale(uint8_t slot) {
+    return bitmap_get(index_stale, slot);
+}
+
+static void storage_set_live(uint8_t slot, uint8_t live) {
+    if (storage_slot_live(slot) == live) return;
+    bitmap_set(index_live, slot, live);
+    if (live) {
+        live_count++;
+    } else {
+        live_count--;
+    }
+}
+
+static void storage_set_stale(uint8_t slot, uint8_t stale) {
+    bitmap_set(index_stale, slot, stale);
+}
+
+// a plus recent que b (arithmetique modulo 2^16)
+static uint8_t storage_seq_newer(uint16_t a, uint16_t b) {
+    return (int16_t)(a - b) > 0;
+}
+
+// Octet de commit d'un record: CRC8 des champs qui le precedent. Ni 0x00
+// (slot libre) ni 0xFF (EEPROM effacee): un corps a moitie ecrit, un octet de
+// commit arrache ou un slot vierge ne passent pas pour un record complet.
+#define COMMIT_FREE 0x00
+#define COMMIT_ERASED 0xFF
+#define COMMIT_REMAP 0x5A
+
+// CRC8 de polynome 0x07 (celui de _crc8_ccitt_update d'avr-libc), ecrit ici
+// pour que storage.c compile aussi sur l'hote (storage_file.c)
+static uint8_t storage_crc8(uint8_t crc, uint8_t data) {
+    crc ^= data;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+        crc = (crc & 0x80) ? (uint8_t)(crc << 1) ^ 0x07 : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+static uint8_t storage_commit_of(const CredentialEntry* entry) {
+    const uint8_t* bytes = (const uint8_t*)entry;
+    uint8_t crc = 0;
+    for (uint8_t i = 0; i < offsetof(CredentialEntry, commit); i++) {
+        crc = storage_crc8(crc, bytes[i]);
+    }
+    return (crc == COMMIT_FREE || crc == COMMIT_ERASED) ? COMMIT_REMAP : crc;
+}
+
+// @return 1 si le record du slot est complet (lu dans entry)
+static uint8_t storage_read_entry(uint8_t slot, CredentialEntry* entry) {
+    st_read(entry, RECORD_ADDR(slot, seq), RECORD_SIZE);
+    return entry->commit == storage_commit_of(entry);
+}
+
+static uint8_t storage_hash_equals(uint8_t slot, const uint8_t* app_id_hash) {
+    uint8_t stored_hash[STORAGE_APP_HASH_SIZE];
+    st_read(stored_hash, RECORD_ADDR(slot, app_id_hash), STORAGE_APP_HASH_SIZE);
+    return memcmp(stored_hash, app_id_hash, STORAGE_APP_HASH_SIZE) == 0;
+}
+
+static uint8_t storage_slot_matches(uint8_t slot, const uint8_t* app_id_hash) {
+    return storage_slot_live(slot) && index_fingerprint[slot] == storage_fingerprint(app_id_hash) &&
+           storage_hash_equals(slot, app_id_hash);
+}
+
+// cherche le record vivant le plus recent de app_id_hash, -1 si absent
+static int16_t storage_lookup(const uint8_t* app_id_hash) {
+    int16_t found = -1;
+    uint16_t found_seq = 0;
+    for (uint8_t i = 0; i < log_slots; i++) {
+        if (storage_slot_matches(i, app_id_hash)) {
+            uint16_t seq = st_read_word(RECORD_ADDR(i, seq));
+            if (found == -1 || storage_seq_newer(seq, found_seq)) {
+                found = i;
+                found_seq = seq;
             }
-        } else if (free_slot == -1) {
-            free_slot = i;
         }
     }
+    return found;
+}
+
+// cherche le record vivant de cred_id pour app_id_hash, -1 si absent
+static int16_t storage_lookup_credential(const uint8_t* app_id_hash, const uint8_t* cred_id) {
+    for (uint8_t i = 0; i < log_slots; i++) {
+        if (storage_slot_live(i) && index_cred_fingerprint[i] == cred_id[0]) {
+            uint8_t stored_id[CREDENTIAL_ID_SIZE];
+            st_read(stored_id, RECORD_ADDR(i, credential_id), CREDENTIAL_ID_SIZE);
+            if (memcmp(stored_id, cred_id, CREDENTIAL_ID_SIZE) == 0 && storage_hash_equals(i, app_id_hash)) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+// Compteur a 0: cellule 0 = 0, les autres comme si elles venaient du tour precedent
+static void storage_counter_format(void) {
+    SignCounter counter = {{0}, {0}};
+    for (uint8_t i = 1; i < SIGN_COUNTER_CELLS; i++) {
+        counter.cells[i] = (uint8_t)(i - SIGN_COUNTER_CELLS);
+    }
+    st_write(&counter, COUNTER_ADDR(high), sizeof(counter));
+}
+
+// La derniere cellule ecrite est celle qui n'est pas suivie de sa valeur + 1.
+// Une ecriture interrompue de la cellule i > 0 casse la suite en i - 1: on
+// repart de la valeur precedente. Une cellule 0 saine suit la cellule 15
+// (ecrite en dernier) ou precede la cellule 1 (tour precedent): sinon elle est
+// dechiree et on repart de la cellule 15. Au passage a 256, le poids fort est
+// deja ecrit: le compteur saute alors en avant, jamais en arriere.
+static void storage_counter_recover(void) {
+    SignCounter counter;
+    uint8_t last = SIGN_COUNTER_CELLS - 1;
+
+    st_read(&counter, COUNTER_ADDR(high), sizeof(counter));
+    uint8_t cell0_latest = counter.cells[0] == (uint8_t)(counter.cells[SIGN_COUNTER_CELLS - 1] + 1);
+    uint8_t cell0_old = counter.cells[1] == (uint8_t)(counter.cells[0] + 1);
+    for (uint8_t i = (cell0_latest || cell0_old) ? 0 : 1; i < SIGN_COUNTER_CELLS; i++) {
+        uint8_t next = counter.cells[(i + 1) % SIGN_COUNTER_CELLS];
+        if (next != (uint8_t)(counter.cells[i] + 1)) {
+            last = i;
+            break;
+        }
+    }
+    sign_counter = ((uint32_t)counter.high[0] << 24) | ((uint32_t)counter.high[1] << 16) |
+                   ((uint32_t)counter.high[2] << 8) | counter.cells[last];
+}
+
+uint32_t storage_counter_next(void) {
+    uint32_t next = sign_counter + 1;
+    uint8_t low = (uint8_t)next;
+
+    // poids fort d'abord: une coupure entre les deux fait sauter le compteur
+    // de 256 en avant, jamais en arriere
+    if (low == 0) {
+        uint8_t high[3] = {(uint8_t)(next >> 24), (uint8_t)(next >> 16), (uint8_t)(next >> 8)};
+        st_write(high, COUNTER_ADDR(high), sizeof(high));
+    }
+    st_write_byte(COUNTER_ADDR(cells) + low % SIGN_COUNTER_CELLS, low);
+    // la valeur n'est rendue (puis envoyee) qu'une fois programmee: la file
+    // etant FIFO, tout vider revient a attendre cette cellule
+    backend->sync();
+    storage_flush();
+    sign_counter = next;
+    return next;
+}
+
+// EEPROM vierge ou ancienne disposition: aucun record, generation 0
+// (les slots d'une ancienne disposition sont effaces par storage_scrub_step)
+static void storage_format(void) {
+    storage_counter_format();
+    st_write_byte(HEADER_ADDR(epoch), 0);
+    st_write_byte(HEADER_ADDR(format), STORAGE_FORMAT_NO_KEY);
+}
+
+// Un record de remplacement (MAKE_CREDENTIAL) masque les records plus anciens
+// de son app_id: les records d'un meme app_id restent tous vivants sinon.
+static void storage_apply_replace(uint8_t slot) {
+    uint8_t hash[STORAGE_APP_HASH_SIZE];
+    uint16_t seq = st_read_word(RECORD_ADDR(slot, seq));
+
+    st_read(hash, RECORD_ADDR(slot, app_id_hash), STORAGE_APP_HASH_SIZE);
+    for (uint8_t i = 0; i < log_slots; i++) {
+        if (i != slot && storage_slot_matches(i, hash) &&
+            storage_seq_newer(seq, st_read_word(RECORD_ADDR(i, seq)))) {
+            storage_set_live(i, 0);
+        }
+    }
+}
+
+// Relecture du journal: seuls les records complets de la generation courante
+// comptent (un record a moitie ecrit lors d'une coupure n'a pas un octet de
+// commit correct), et un record de remplacement masque les records plus anciens
+// de son app_id. Tout autre slot dont le commit n'est pas libre (ancienne
+// generation, effacement interrompu) peut garder une cle: il est a effacer.
+void storage_init(void) {
+    uint8_t have_seq = 0;
+    uint16_t max_seq = 0;
+    uint8_t format;
+    uint16_t slots;
+
+    backend->init();
+    slots = (backend->size() - LOG_ADDR) / RECORD_SIZE;
+    log_slots = slots < STORAGE_MAX_SLOTS ? slots : STORAGE_MAX_SLOTS;
+
+    format = st_read_byte(HEADER_ADDR(format));
+    if (format != STORAGE_FORMAT_NO_KEY && format != STORAGE_FORMAT_KEY) {
+        storage_format();
+        backend->sync();
+    }
+
+    storage_counter_recover();
+
+    current_epoch = st_read_byte(HEADER_ADDR(epoch)) & EPOCH_MASK;
+    memset(index_live, 0, BITMAP_SIZE);
+    memset(index_stale, 0, BITMAP_SIZE);
+    live_count = 0;
+    log_head = 0;
+    for (uint8_t i = 0; i < log_slots; i++) {
+        CredentialEntry entry;
+        uint8_t complete = storage_read_entry(i, &entry);
+        if (!complete || (entry.meta & EPOCH_MASK) != current_epoch) {
+            storage_set_stale(i, entry.commit != COMMIT_FREE && entry.commit != COMMIT_ERASED);
+            memset(&entry, 0, sizeof(entry));
+            continue;
+        }
+        uint16_t seq = entry.seq;
+        index_fingerprint[i] = storage_fingerprint(entry.app_id_hash);
+        index_cred_fingerprint[i] = entry.credential_id[0];
+        memset(&entry, 0, sizeof(entry));
+        storage_set_live(i, 1);
+
+        if (!have_seq || storage_seq_newer(seq, max_seq)) {
+            have_seq = 1;
+            max_seq = seq;
+            log_head = (i + 1) % log_slots;
+        }
+    }
+    log_seq = have_seq ? max_seq + 1 : 0;
+
+    // l'ordre n'importe pas: un record masque par un remplacement plus recent
+    // masque lui-meme des records encore plus anciens
+    for (uint8_t i = 0; i < log_slots; i++) {
+        if (storage_slot_live(i) && (st_read_byte(RECORD_ADDR(i, meta)) & META_REPLACE_BIT)) {
+            storage_apply_replace(i);
+        }
+    }
+}
+
+uint8_t storage_epoch(void) {
+    return current_epoch;
+}
+
+uint8_t storage_load_master_key(uint8_t* key_out) {
+    if (st_read_byte(HEADER_ADDR(format)) != STORAGE_FORMAT_KEY) {
+        return 0;
+    }
+    st_read(key_out, HEADER_ADDR(master_key), MASTER_KEY_SIZE);
+    return 1;
+}
+
+void storage_save_master_key(const uint8_t* key) {
+    st_write_byte(HEADER_ADDR(format), STORAGE_FORMAT_NO_KEY);
+    st_write(key, HEADER_ADDR(master_key), MASTER_KEY_SIZE);
+    st_write_byte(HEADER_ADDR(format), STORAGE_FORMAT_KEY);
+    backend->sync();
+}
+
+// Efface la cle et le commit d'un slot qui n'est pas vivant. La cle est
+// effacee avant le commit: apres une coupure entre les deux, le commit n'est
+// pas libre et storage_init remet le slot a effacer.
+static void storage_scrub_slot(uint8_t slot) {
+    if (!storage_slot_live(slot) && st_read_byte(RECORD_ADDR(slot, commit)) != COMMIT_FREE) {
+        uint8_t zero_buffer[PACKED_KEY_SIZE] = {0};
+        uint8_t meta = st_read_byte(RECORD_ADDR(slot, meta));
+        st_write(zero_buffer, RECORD_ADDR(slot, private_key), PACKED_KEY_SIZE);
+        st_write_byte(RECORD_ADDR(slot, meta), meta & EPOCH_MASK);
+        st_write_byte(RECORD_ADDR(slot, commit), COMMIT_FREE);
+    }
+    storage_set_stale(slot, 0);
+}
+
+uint8_t storage_scrub_step(void) {
+    // un seul slot en file a la fois pour ne pas bloquer le programme sur une file pleine
+    if (storage_busy()) return bitmap_any(index_stale);
+    for (uint8_t i = 0; i < log_slots; i++) {
+        if (storage_slot_stale(i)) {
+            storage_scrub_slot(i);
+            backend->sync();
+            break;
+        }
+    }
+    return bitmap_any(index_stale);
+}
+
+uint8_t storage_scrub_remaining(void) {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < log_slots; i++) {
+        count += storage_slot_stale(i);
+    }
+    return count;
+}
+
+// RESET = changer de generation: un seul octet ecrit, les anciens records
+// deviennent invisibles et leurs cles sont effacees ensuite par storage_scrub_step
+void storage_reset(void) {
+    uint8_t next_epoch = (current_epoch + 1) & EPOCH_MASK;
 
-    int8_t target = (existing_slot != -1) ? existing_slot : free_slot;
+    // apres 64 RESET un record pas encore efface reviendrait a la vie
+    for (uint8_t i = 0; i < log_slots; i++) {
+        if (storage_slot_stale(i) && (st_read_byte(RECORD_ADDR(i, meta)) & EPOCH_MASK) == next_epoch) {
+            storage_scrub_slot(i);
+        }
+    }
 
+    st_write_byte(HEADER_ADDR(epoch), next_epoch);
+    backend->sync();
+    current_epoch = next_epoch;
+
+    // tous les slots peuvent contenir une cle (y compris les records remplaces)
+    for (uint8_t i = 0; i < log_slots; i++) {
+        storage_set_stale(i, 1);
+    }
+    memset(index_live, 0, BITMAP_SIZE);
+    live_count = 0;
+    log_head = 0;
+}
+
+// Ecrit un record dans un slot: invalidation, corps puis octet de commit en
+// dernier, tous dans le slot (l'usure reste repartie sur le journal)
+static void storage_write_record(uint8_t slot, uint8_t flags, const uint8_t* app_id_hash, const uint8_t* cred_id, const uint8_t* priv_key) {
+    CredentialEntry entry;
+
+    memset(&entry, 0, sizeof(entry));
+    entry.meta = current_epoch | flags | (priv_key[0] ? META_KEY_BIT : 0);
+    entry.seq = log_seq;
+    memcpy(entry.app_id_hash, app_id_hash, STORAGE_APP_HASH_SIZE);
+    memcpy(entry.credential_id, cred_id, CREDENTIAL_ID_SIZE);
+    memcpy(entry.private_key, priv_key + 1, PACKED_KEY_SIZE);
+    entry.commit = storage_commit_of(&entry);
+
+    st_write_byte(RECORD_ADDR(slot, commit), COMMIT_FREE);
+    st_write(&entry, RECORD_ADDR(slot, seq), offsetof(CredentialEntry, commit));
+    st_write_byte(RECORD_ADDR(slot, commit), entry.commit);
+    memset(&entry, 0, sizeof(entry));
+    log_seq++;
+}
+
+static uint8_t storage_append(uint8_t flags, const uint8_t* app_id_hash, const uint8_t* cred_id, const uint8_t* priv_key) {
+    int16_t existing = (flags & META_REPLACE_BIT) ? storage_lookup(app_id_hash) : -1;
+    int16_t target = -1;
+
+    // Ajout au premier slot mort a partir de la tete: les records remplaces ou
+    // effaces sont recycles au passage, ce qui repartit l'usure sur tout le journal
+    for (uint8_t n = 0; n < log_slots; n++) {
+        uint8_t slot = (log_head + n) % log_slots;
+        if (!storage_slot_live(slot)) {
+            target = slot;
+            break;
+        }
+    }
+
+    // Journal plein de records vivants: un remplacement se fait sur place
+    if (target == -1) target = existing;
     if (target == -1) return 0; // Storage Full
 
-    // Écriture
-    uint8_t flag = 0x01;
-    eeprom_write_byte(&eeprom_entries[target].used, flag);
-    eeprom_write_block(app_id_hash, eeprom_entries[target].app_id_hash, SHA1_APP_ID_SIZE);
-    eeprom_write_block(cred_id, eeprom_entries[target].credential_id, CREDENTIAL_ID_SIZE);
-    eeprom_write_block(priv_key, eeprom_entries[target].private_key, PRIVATE_KEY_SIZE);
+    storage_write_record(target, flags, app_id_hash, cred_id, priv_key);
+    backend->sync();
 
+    storage_set_stale(target, 0);
+    index_fingerprint[target] = storage_fingerprint(app_id_hash);
+    index_cred_fingerprint[target] = cred_id[0];
+    storage_set_live(target, 1);
+    if (flags & META_REPLACE_BIT) storage_apply_replace(target);
+    log_head = (target + 1) % log_slots;
     return 1;
 }
 
+uint8_t storage_save(const uint8_t* app_id_hash, const uint8_t* cred_id, const uint8_t* priv_key) {
+    return storage_append(META_REPLACE_BIT, app_id_hash, cred_id, priv_key);
+}
+
+uint8_t storage_add(const uint8_t* app_id_hash, const uint8_t* cred_id, const uint8_t* priv_key) {
+    return storage_append(0, app_id_hash, cred_id, priv_key);
+}
+
+static void storage_read_key(uint8_t slot, uint8_t* priv_key_out) {
+    priv_key_out[0] = (st_read_byte(RECORD_ADDR(slot, meta)) & META_KEY_BIT) ? 1 : 0;
+    st_read(priv_key_out + 1, RECORD_ADDR(slot, private_key), PACKED_KEY_SIZE);
+}
+
 uint8_t storage_find_key(const uint8_t* app_id_hash, uint8_t* priv_key_out, uint8_t* cred_id_out) {
-    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
-        if (eeprom_read_byte(&eeprom_entries[i].used) == 0x01) {
-            uint8_t stored_hash[SHA1_APP_ID_SIZE];
-            eeprom_read_block(stored_hash, eeprom_entries[i].app_id_hash, SHA1_APP_ID_SIZE);
-            if (memcmp(stored_hash, app_id_hash, SHA1_APP_ID_SIZE) == 0) {
-                eeprom_read_block(priv_key_out, eeprom_entries[i].private_key, PRIVATE_KEY_SIZE);
-                if(cred_id_out) eeprom_read_block(cred_id_out, eeprom_entries[i].credential_id, CREDENTIAL_ID_SIZE);
-                return 1;
-            }
-        }
+    int16_t slot = storage_lookup(app_id_hash);
+    if (slot == -1) return 0;
+
+    storage_read_key(slot, priv_key_out);
+    if(cred_id_out) st_read(cred_id_out, RECORD_ADDR(slot, credential_id), CREDENTIAL_ID_SIZE);
+    return 1;
+}
+
+uint8_t storage_find_credential(const uint8_t* app_id_hash, const uint8_t* cred_id, uint8_t* priv_key_out) {
+    int16_t slot = storage_lookup_credential(app_id_hash, cred_id);
+    if (slot == -1) return 0;
+
+    storage_read_key(slot, priv_key_out);
+    return 1;
+}
+
+uint8_t storage_count(void) {
+    return live_count;
+}
+
+uint8_t storage_capacity(void) {
+    return log_slots;
+}
+
+// le prefixe porte sur le hash complete par des zeros, comme il est renvoye
+static uint8_t storage_prefix_matches(uint8_t slot, const uint8_t* prefix, uint8_t prefix_len) {
+    uint8_t stored_hash[STORAGE_APP_HASH_SIZE];
+    uint8_t stored_len = prefix_len < STORAGE_APP_HASH_SIZE ? prefix_len : STORAGE_APP_HASH_SIZE;
+
+    if (prefix_len == 0) return 1;
+    // l'empreinte en RAM evite de lire le support pour la plupart des slots
+    if (index_fingerprint[slot] != prefix[0]) return 0;
+    for (uint8_t i = stored_len; i < prefix_len; i++) {
+        if (prefix[i] != 0) return 0;
     }
-    return 0;
+    st_read(stored_hash, RECORD_ADDR(slot, app_id_hash), stored_len);
+    return memcmp(stored_hash, prefix, stored_len) == 0;
 }
 
-void storage_iterate(void (*callback)(uint8_t* cred_id, uint8_t* app_hash, void* data), void* data) {
-    for (uint8_t i = 0; i < MAX_ENTRIES; i++) {
-        if (eeprom_read_byte(&eeprom_entries[i].used) == 0x01) {
-             uint8_t c_id[CREDENTIAL_ID_SIZE];
-             uint8_t a_hash[SHA1_APP_ID_SIZE];
-             eeprom_read_block(c_id, eeprom_entries[i].credential_id, CREDENTIAL_ID_SIZE);
-             eeprom_read_block(a_hash, eeprom_entries[i].app_id_hash, SHA1_APP_ID_SIZE);
-             // Le contexte est passé
-             callback(c_id, a_hash, data);
+uint8_t storage_iterate_page(uint8_t cursor, uint8_t max, const uint8_t* prefix, uint8_t prefix_len,
+                             void (*callback)(uint8_t* cred_id, uint8_t* app_hash, void* data), void* data) {
+    uint8_t count = 0;
+    for (uint8_t i = cursor; i < log_slots; i++) {
+        if (storage_slot_live(i) && storage_prefix_matches(i, prefix, prefix_len)) {
+            uint8_t c_id[CREDENTIAL_ID_SIZE];
+            uint8_t a_hash[SHA1_APP_ID_SIZE] = {0};
+            if (count == max) return i;
+            st_read(c_id, RECORD_ADDR(i, credential_id), CREDENTIAL_ID_SIZE);
+            st_read(a_hash, RECORD_ADDR(i, app_id_hash), STORAGE_APP_HASH_SIZE);
+            // Le contexte est passé
+            callback(c_id, a_hash, data);
+            count++;
         }
     }
+    return STORAGE_CURSOR_END;
+}
+
+void storage_iterate(void (*callback)(uint8_t* cred_id, uint8_t* app_hash, void* data), void* data) {
+    storage_iterate_page(0, STORAGE_MAX_SLOTS, NULL, 0, callback, data);
 }
@@ -4,22 +4,118 @@
 #include <stdint.h>
 #include "consts.h"
 
+// Octets du sha1 de l'app_id gardes dans un record. Le tronquer (ex:
+// -DSTORAGE_APP_HASH_SIZE=8) augmente la capacite: la recherche se fait alors
+// sur le prefixe et LIST renvoie ce prefixe complete par des zeros.
+#ifndef STORAGE_APP_HASH_SIZE
+#define STORAGE_APP_HASH_SIZE SHA1_APP_ID_SIZE
+#endif
+
+// la cle secp160r1 fait 161 bits: le bit de poids fort va dans meta
+#define PACKED_KEY_SIZE (PRIVATE_KEY_SIZE - 1)
+// taille des bitmaps de l'en-tete et de l'index, multiple de 8
+// (128 pour le journal en flash, voir storage_flash.c)
+#ifndef STORAGE_MAX_SLOTS
+#define STORAGE_MAX_SLOTS 24
+#endif
+
+// Record du journal de credentials. seq en tete: aucun octet de bourrage entre
+// les champs, meme sur l'hote (storage_file.c) ou un uint16_t est aligne sur 2
 typedef struct {
-    uint8_t used; // 0xFF si vide, 0x01 si utilisé
-    uint8_t app_id_hash[SHA1_APP_ID_SIZE];
+    uint16_t seq;   // numero de sequence, un remplacement masque les plus anciens de son app_id
+    uint8_t meta;   // bit 7: bit de poids fort de la cle, bit 6: remplacement, bits 0-5: generation
+    uint8_t app_id_hash[STORAGE_APP_HASH_SIZE];
     uint8_t credential_id[CREDENTIAL_ID_SIZE];
-    uint8_t private_key[PRIVATE_KEY_SIZE];
+    uint8_t private_key[PACKED_KEY_SIZE]; // 160 bits de poids faible
+    uint8_t commit; // ecrit en dernier: controle des champs precedents, 0 = slot libre
 } CredentialEntry;
 
+// En-tete du stockage
+typedef struct {
+    uint8_t format; // disposition reconnue, et cle maitre commitee ou non
+    uint8_t epoch;  // incremente a chaque RESET (6 bits)
+    uint8_t master_key[MASTER_KEY_SIZE]; // cle des credentials emballes (keywrap)
+} StorageHeader;
+
+// Compteur de signatures en anneau: la cellule (valeur mod N) recoit l'octet
+// de poids faible, les 3 octets de poids fort ne changent que tous les 256.
+// N divise 256 pour que la derniere cellule ecrite soit la seule rupture de la
+// suite c[i+1] == c[i] + 1 autour de l'anneau.
+#define SIGN_COUNTER_CELLS 16
+
+typedef struct {
+    uint8_t high[3]; // poids fort, big endian
+    uint8_t cells[SIGN_COUNTER_CELLS];
+} SignCounter;
+
 void storage_init(void);
 
+// Les ecritures passent par le support choisi (storage_backend.h), qui peut les
+// faire en tache de fond (ISR EE_READY pour l'EEPROM) ou les garder en tampon.
+// Les lectures du module voient toujours les ecritures en attente.
+
+// @return 1 si des ecritures sont en attente ou en cours
+uint8_t storage_busy(void);
+
+// Attend (en dormant) que toutes les ecritures en file soient faites
+void storage_flush(void);
+
+// Barriere: ticket couvrant toutes les ecritures mises en file jusqu'ici
+uint16_t storage_barrier(void);
+
+// @return 1 si les ecritures precedant la barriere <ticket> sont programmees
+uint8_t storage_committed(uint16_t ticket);
+
 void storage_reset(void);
 
+// Incremente le compteur de signatures (en general un seul octet ecrit)
+// et attend que l'ecriture soit faite
+// @return la nouvelle valeur
+uint32_t storage_counter_next(void);
+
+// Generation courante du stockage (changee par storage_reset)
+uint8_t storage_epoch(void);
+
+// @return 1 si la cle maitre existe (copiee dans key_out), 0 sinon
+uint8_t storage_load_master_key(uint8_t* key_out);
+
+void storage_save_master_key(const uint8_t* key);
+
+// Efface la cle d'un record d'une ancienne generation.
+// @return 1 s'il reste des records a effacer, 0 sinon
+uint8_t storage_scrub_step(void);
+
+// Nombre de slots restant a verifier par storage_scrub_step
+uint8_t storage_scrub_remaining(void);
+
+// Enregistre un credential qui remplace ceux du meme app_id (MAKE_CREDENTIAL)
 uint8_t storage_save(const uint8_t* app_id_hash, const uint8_t* cred_id, const uint8_t* priv_key);
 
+// Enregistre un credential de plus pour cet app_id (plusieurs comptes par site)
+uint8_t storage_add(const uint8_t* app_id_hash, const uint8_t* cred_id, const uint8_t* priv_key);
+
+// Credential le plus recent de app_id_hash
 uint8_t storage_find_key(const uint8_t* app_id_hash, uint8_t* priv_key_out, uint8_t* cred_id_out);
 
+// Credential cred_id de app_id_hash, trouve par l'index des credential ids
+uint8_t storage_find_credential(const uint8_t* app_id_hash, const uint8_t* cred_id, uint8_t* priv_key_out);
+
+// Nombre de credentials vivants (tenu a jour en RAM)
+uint8_t storage_count(void);
+
+// Nombre de slots du journal (credentials vivants au plus)
+uint8_t storage_capacity(void);
+
 // Le callback accepte maintenant un pointeur void* (le contexte)
 void storage_iterate(void (*callback)(uint8_t* cred_id, uint8_t* app_hash, void* data), void* data);
 
+#define STORAGE_CURSOR_END 0xFF
+
+// Parcourt au plus <max> credentials a partir du curseur <cursor> (0 au debut),
+// en ne gardant que ceux dont le hash d'app_id commence par <prefix>.
+// Le curseur est un numero de slot: il reste valable tant que le journal ne change pas.
+// @return le curseur de la page suivante, STORAGE_CURSOR_END a la fin
+uint8_t storage_iterate_page(uint8_t cursor, uint8_t max, const uint8_t* prefix, uint8_t prefix_len,
+                             void (*callback)(uint8_t* cred_id, uint8_t* app_hash, void* data), void* data);
+
 #endif
@@ -0,0 +1,34 @@
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include <stdint.h>
+
+// Support physique du stockage, vu comme une memoire adressee a l'octet.
+// Le journal de credentials (storage.c) ne connait que cette interface:
+// format des records, index RAM et regles de reprise sont communs a tous les supports.
+typedef struct {
+    void (*init)(void);
+    // taille utilisable en octets
+    uint16_t (*size)(void);
+    // lecture qui voit les ecritures pas encore faites sur le support
+    void (*read)(void* dst, uint16_t addr, uint16_t len);
+    // ecriture, faite dans l'ordre d'appel (un commit ecrit apres un corps reste apres lui)
+    void (*write)(const void* src, uint16_t addr, uint16_t len);
+    // pousse vers le support ce qui est en tampon, sans forcement attendre la fin
+    void (*sync)(void);
+    // 1 si des ecritures sont en attente ou en cours
+    uint8_t (*busy)(void);
+    // attend que tout soit ecrit
+    void (*flush)(void);
+    // nombre d'octets (modulo 2^16) effectivement ecrits depuis le demarrage
+    uint16_t (*written)(void);
+} StorageBackend;
+
+// EEPROM interne, ecritures en tache de fond par l'ISR EE_READY (storage_eeprom.c)
+extern const StorageBackend storage_backend_eeprom;
+// memoire flash programme libre, pages ecrites par SPM depuis la section boot (storage_flash.c)
+extern const StorageBackend storage_backend_flash;
+// fichier sur l'hote pour l'emulation (storage_file.c)
+extern const StorageBackend storage_backend_file;
+
+#endif // STORAGE_BACKEND_H
@@ -0,0 +1,159 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+
+#include "storage_backend.h"
+#include "stats.h"
+
+// File d'ecritures EEPROM videe par l'ISR EE_READY: une ecriture d'octet prend
+// ~3.3ms, le programme continue (repondre sur l'UART, dormir) pendant ce temps.
+// Les octets sont ecrits dans l'ordre de la file, donc un octet de commit mis
+// en file apres le corps d'un record est toujours ecrit apres lui.
+#define EEQ_DATA_SIZE 64 // puissance de 2
+#define EEQ_RUNS 8       // puissance de 2
+
+struct eeq_run {
+    uint16_t addr; // prochaine adresse EEPROM a ecrire
+    uint16_t len;  // octets restants
+};
+
+static volatile uint8_t eeq_data[EEQ_DATA_SIZE];
+static volatile struct eeq_run eeq_runs[EEQ_RUNS];
+static volatile uint8_t eeq_data_head = 0, eeq_data_tail = 0;
+static volatile uint8_t eeq_run_head = 0, eeq_run_tail = 0;
+static volatile uint16_t eeq_written = 0; // octets ecrits en EEPROM (ISR)
+static volatile uint8_t eeq_in_flight = 0; // ecriture lancee, pas encore finie
+
+// EE_READY: l'ecriture precedente est finie
+ISR(EE_READY_vect) {
+    eeq_written += eeq_in_flight;
+    eeq_in_flight = 0;
+
+    uint8_t tail = eeq_data_tail;
+    if (eeq_run_tail == eeq_run_head || tail == eeq_data_head) {
+        // rien a ecrire (ou octets pas encore en file): on coupe l'interruption
+        EECR &= ~(1 << EERIE);
+        return;
+    }
+    volatile struct eeq_run* run = &eeq_runs[eeq_run_tail];
+    uint8_t data = eeq_data[tail];
+
+    // on n'use pas la cellule si elle contient deja la valeur
+    EEAR = run->addr;
+    EECR |= (1 << EERE);
+    if (EEDR != data) {
+        EEDR = data;
+        EECR |= (1 << EEMPE);
+        EECR |= (1 << EEPE);
+        stats_storage_bytes(1);
+        // compte a l'interruption suivante, une fois l'octet programme
+        eeq_in_flight = 1;
+    } else {
+        eeq_written++;
+    }
+
+    run->addr++;
+    if (--run->len == 0) {
+        eeq_run_tail = (eeq_run_tail + 1) & (EEQ_RUNS - 1);
+    }
+    eeq_data_tail = (tail + 1) & (EEQ_DATA_SIZE - 1);
+}
+
+// attente d'une interruption (EE_READY en general) en dormant
+static void eeq_sleep(void) {
+    cli();
+    EECR |= (1 << EERIE);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
+static void eeprom_backend_init(void) {
+}
+
+static uint16_t eeprom_backend_size(void) {
+    return E2END + 1;
+}
+
+// Met en file l'ecriture de len octets a l'adresse addr, attend si la file est pleine
+static void eeprom_backend_write(const void* src, uint16_t addr, uint16_t len) {
+    const uint8_t* bytes = (const uint8_t*)src;
+    uint8_t run_next = (eeq_run_head + 1) & (EEQ_RUNS - 1);
+
+    if (len == 0) return;
+    while (run_next == eeq_run_tail) {
+        eeq_sleep();
+    }
+    eeq_runs[eeq_run_head].addr = addr;
+    eeq_runs[eeq_run_head].len = len;
+    eeq_run_head = run_next;
+
+    for (uint16_t i = 0; i < len; i++) {
+        uint8_t data_next = (eeq_data_head + 1) & (EEQ_DATA_SIZE - 1);
+        while (data_next == eeq_data_tail) {
+            eeq_sleep();
+        }
+        eeq_data[eeq_data_head] = bytes[i];
+        eeq_data_head = data_next;
+        EECR |= (1 << EERIE);
+    }
+}
+
+// Lecture qui voit les ecritures encore en file: l'ISR est suspendue pendant
+// la lecture, puis les octets en attente recouvrent ceux lus en EEPROM
+static void eeprom_backend_read(void* dst, uint16_t start, uint16_t len) {
+    uint8_t* out = (uint8_t*)dst;
+
+    EECR &= ~(1 << EERIE);
+    eeprom_read_block(dst, (const void*)(uintptr_t)start, len);
+
+    uint8_t data = eeq_data_tail;
+    for (uint8_t r = eeq_run_tail; r != eeq_run_head; r = (r + 1) & (EEQ_RUNS - 1)) {
+        uint16_t addr = eeq_runs[r].addr;
+        for (uint16_t n = eeq_runs[r].len; n > 0 && data != eeq_data_head; n--, addr++) {
+            if (addr >= start && addr - start < len) {
+                out[addr - start] = eeq_data[data];
+            }
+            data = (data + 1) & (EEQ_DATA_SIZE - 1);
+        }
+    }
+
+    if (eeq_run_tail != eeq_run_head || eeq_in_flight) {
+        EECR |= (1 << EERIE);
+    }
+}
+
+// tout est deja en file, l'ISR s'en charge
+static void eeprom_backend_sync(void) {
+}
+
+static uint8_t eeprom_backend_busy(void) {
+    return eeq_run_tail != eeq_run_head || eeq_in_flight;
+}
+
+static void eeprom_backend_flush(void) {
+    while (eeprom_backend_busy()) {
+        eeq_sleep();
+    }
+}
+
+static uint16_t eeprom_backend_written(void) {
+    uint16_t written;
+    cli();
+    written = eeq_written;
+    sei();
+    return written;
+}
+
+const StorageBackend storage_backend_eeprom = {
+    .init = eeprom_backend_init,
+    .size = eeprom_backend_size,
+    .read = eeprom_backend_read,
+    .write = eeprom_backend_write,
+    .sync = eeprom_backend_sync,
+    .busy = eeprom_backend_busy,
+    .flush = eeprom_backend_flush,
+    .written = eeprom_backend_written
+};
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "storage_backend.h"
+
+// Stockage dans un fichier pour faire tourner storage.c sur l'hote (tests,
+// emulation): meme disposition que l'EEPROM de l'ATmega328P (16 slots), fichier neuf rempli
+// de 0xFF comme une EEPROM effacee. Chemin: $YUBINO_STORAGE ou STORAGE_FILE_DEFAULT.
+// Ce module n'est pas compile pour l'AVR.
+#define STORAGE_FILE_SIZE 1024
+#define STORAGE_FILE_DEFAULT "yubino-storage.bin"
+
+static FILE* storage_file = NULL;
+static uint16_t file_written = 0;
+
+static void file_backend_init(void) {
+    const char* path = getenv("YUBINO_STORAGE");
+    if (path == NULL) path = STORAGE_FILE_DEFAULT;
+
+    storage_file = fopen(path, "r+b");
+    if (storage_file == NULL) {
+        uint8_t blank[STORAGE_FILE_SIZE];
+        storage_file = fopen(path, "w+b");
+        if (storage_file == NULL) {
+            perror(path);
+            exit(1);
+        }
+        memset(blank, 0xFF, sizeof(blank));
+        fwrite(blank, 1, sizeof(blank), storage_file);
+        fflush(storage_file);
+    }
+}
+
+static uint16_t file_backend_size(void) {
+    return STORAGE_FILE_SIZE;
+}
+
+static void file_backend_read(void* dst, uint16_t addr, uint16_t len) {
+    memset(dst, 0xFF, len);
+    fseek(storage_file, addr, SEEK_SET);
+    if (fread(dst, 1, len, storage_file) != len) {
+        clearerr(storage_file);
+    }
+}
+
+static void file_backend_write(const void* src, uint16_t addr, uint16_t len) {
+    fseek(storage_file, addr, SEEK_SET);
+    fwrite(src, 1, len, storage_file);
+    file_written += len;
+}
+
+static void file_backend_sync(void) {
+    fflush(storage_file);
+}
+
+static uint8_t file_backend_busy(void) {
+    return 0;
+}
+
+static uint16_t file_backend_written(void) {
+    return file_written;
+}
+
+const StorageBackend storage_backend_file = {
+    .init = file_backend_init,
+    .size = file_backend_size,
+    .read = file_backend_read,
+    .write = file_backend_write,
+    .sync = file_backend_sync,
+    .busy = file_backend_busy,
+    .flush = file_backend_sync,
+    .written = file_backend_written
+};
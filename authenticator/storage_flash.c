@@ -0,0 +1,368 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <avr/boot.h>
+#include <string.h>
+
+#include "storage_backend.h"
+#include "stats.h"
+#include "uart.h"
+
+// Journal dans la flash programme libre au lieu de l'EEPROM: 8KB au lieu de 1KB,
+// donc environ 8 fois plus de credentials (STORAGE_MAX_SLOTS=128 dans le Makefile).
+//
+// Limites a connaitre:
+// - une page flash supporte ~10 000 effacements (100 000 pour l'EEPROM) et
+//   s'efface en entier: chaque modification d'octet reecrit toute la page.
+// - une coupure entre l'effacement et l'ecriture d'une page la perdrait en
+//   entier, avec les autres records qu'elle porte: les pages du journal de
+//   credentials passent d'abord par une page de transit (voir plus bas), qui
+//   s'use donc a chaque programmation d'une page du journal.
+// - SPM ne s'execute que depuis la section boot (NRWW): le code d'ecriture est
+//   place dans .bootloader, a l'adresse STORAGE_FLASH_SPM_ADDR du Makefile, et
+//   les fusibles BOOTSZ doivent couvrir cette adresse (0x7000 = BOOTSZ 00, 2K mots).
+//   BOOTRST reste non programme: le reset demarre toujours en 0.
+// - le programme doit tenir sous STORAGE_FLASH_START: verifie apres l'edition
+//   de liens (regle $(ELF) du Makefile).
+// - les vecteurs d'interruption sont dans la section RWW, illisible pendant un
+//   effacement ou une ecriture (~4ms chacun): les interruptions sont coupees
+//   le temps de chacun et de chaque remplissage d'un mot, pas entre les deux. RTS est leve autour (UART__rx_hold):
+//   sans RTS/CTS cable, des octets recus pendant ce temps sont perdus, et le
+//   tick ms du timer0 prend quelques ms de retard.
+//
+// La premiere page du support (en-tete avec la cle maitre, compteur de
+// signatures) change a chaque assertion. Elle n'est donc pas reecrite a chaque
+// fois: ses modifications sont ajoutees a une page journal, mot par mot
+// (decalage, valeur) sans effacement, et ne sont replies dans une page qu'une
+// fois le journal plein. Le repli ecrit l'autre copie de la page et ouvre un
+// journal neuf avec un numero de sequence plus grand: une coupure pendant le
+// repli laisse la paire (copie, journal) precedente intacte, cle maitre comprise.
+//
+// Les autres pages sont copiees dans la page de transit avant d'etre effacees.
+// Le journal de la premiere page note alors la page cible (mot JOURNAL_STAGE),
+// puis la fin de la copie (JOURNAL_STAGE_DONE): au demarrage, une cible notee
+// sans fin est recopiee depuis la page de transit. Le mot de cible porte le
+// numero de page et son complement: programmer ne fait passer des bits que de
+// 1 a 0, un mot interrompu ne peut donc pas designer une autre page.
+#ifndef STORAGE_FLASH_START
+#define STORAGE_FLASH_START 0x5000
+#endif
+#ifndef STORAGE_FLASH_END
+#define STORAGE_FLASH_END 0x7000 // debut de la section boot
+#endif
+
+// pages physiques: copies 0 et 1 de la premiere page, journaux 0 et 1, page
+// de transit, puis les autres pages du support
+#define HOT_COPY_PAGE(pair) ((uint16_t)(pair) * SPM_PAGESIZE)
+#define HOT_JOURNAL_PAGE(pair) ((uint16_t)(2 + (pair)) * SPM_PAGESIZE)
+#define STAGE_PAGE (4 * SPM_PAGESIZE)
+#define FIXED_PAGES 5
+#define DATA_BASE ((FIXED_PAGES - 1) * SPM_PAGESIZE) // page virtuelle 1 -> page physique FIXED_PAGES
+#define FLASH_SIZE (STORAGE_FLASH_END - STORAGE_FLASH_START)
+#define VIRTUAL_SIZE (FLASH_SIZE - DATA_BASE)
+// mot 0 du journal: sequence | ~sequence, puis une modification par mot
+// (decalage < SPM_PAGESIZE) ou un mot de transit
+#define JOURNAL_WORDS (SPM_PAGESIZE / 2)
+#define JOURNAL_STAGE 0x80      // + numero de la page cible, valeur: ~numero
+#define JOURNAL_STAGE_DONE 0xC0 // copie terminee
+#define JOURNAL_EMPTY 0xFF
+#define NO_PAGE 0xFFFF
+#define NO_STAGE 0xFF
+
+_Static_assert(STORAGE_FLASH_START % SPM_PAGESIZE == 0, "STORAGE_FLASH_START doit etre aligne sur une page");
+_Static_assert(FLASH_SIZE % SPM_PAGESIZE == 0, "la zone flash doit faire un nombre entier de pages");
+_Static_assert(SPM_PAGESIZE <= JOURNAL_STAGE, "decalage du journal sur un octet");
+_Static_assert(FLASH_SIZE / SPM_PAGESIZE <= JOURNAL_STAGE_DONE - JOURNAL_STAGE,
+               "numero de page du journal sur 6 bits");
+
+// Une seule page en cache: les ecritures s'y accumulent et la page n'est
+// programmee qu'au changement de page ou a sync(). Les pages sont donc ecrites
+// dans l'ordre des ecritures, comme pour la file EEPROM.
+static uint8_t page_buffer[SPM_PAGESIZE];
+static uint16_t page_addr = NO_PAGE; // decalage de la page en cache dans le support
+static uint8_t page_dirty = 0;
+static uint16_t page_pending = 0;    // octets ecrits dans le cache depuis la derniere programmation
+static uint16_t flash_written = 0;
+
+static uint8_t hot_pair = 0;  // paire (copie, journal) courante de la premiere page
+static uint8_t hot_seq = 0;
+static uint8_t hot_used = 1;  // mots utilises du journal courant, marqueur compris
+
+// Operations SPM, dans la section boot. Elles n'appellent aucune fonction hors
+// de cette section. Le tampon de page est vide apres boot_rww_enable.
+BOOTLOADER_SECTION static void flash_spm_erase(uint16_t addr) {
+    uint8_t sreg = SREG;
+    cli();
+    boot_page_erase(addr);
+    boot_spm_busy_wait();
+    // relit la section RWW pour pouvoir y executer du code a nouveau
+    boot_rww_enable();
+    SREG = sreg;
+}
+
+// SPM doit suivre l'ecriture de SPMCSR de 4 cycles au plus: une interruption
+// entre les deux laisserait le mot a 0xFFFF sans erreur
+BOOTLOADER_SECTION static void flash_spm_fill(uint16_t addr, uint16_t word) {
+    uint8_t sreg = SREG;
+    cli();
+    boot_page_fill(addr, word);
+    SREG = sreg;
+}
+
+// programme les mots remplis (les autres restent a 0xFFFF: sans effacement,
+// les mots deja programmes de la page ne changent pas)
+BOOTLOADER_SECTION static void flash_spm_write(uint16_t addr) {
+    uint8_t sreg = SREG;
+    cli();
+    boot_page_write(addr);
+    boot_spm_busy_wait();
+    boot_rww_enable();
+    SREG = sreg;
+}
+
+// Efface puis programme une page physique depuis buffer
+static void flash_program_page(uint16_t page, const uint8_t* buffer) {
+    uint16_t addr = STORAGE_FLASH_START + page;
+
+    UART__rx_hold();
+    flash_spm_erase(addr);
+    for (uint16_t i = 0; i < SPM_PAGESIZE; i += 2) {
+        flash_spm_fill(addr + i, buffer[i] | ((uint16_t)buffer[i + 1] << 8));
+    }
+    flash_spm_write(addr);
+    UART__rx_resume();
+    stats_storage_bytes(SPM_PAGESIZE);
+}
+
+static uint8_t flash_byte(uint16_t page, uint16_t offset) {
+    return pgm_read_byte(STORAGE_FLASH_START + page + offset);
+}
+
+// premiere page: copie courante recouverte par son journal
+static uint8_t flash_hot_byte(uint8_t offset) {
+    uint8_t value = flash_byte(HOT_COPY_PAGE(hot_pair), offset);
+    for (uint8_t i = 1; i < hot_used; i++) {
+        if (flash_byte(HOT_JOURNAL_PAGE(hot_pair), 2 * i) == offset) {
+            value = flash_byte(HOT_JOURNAL_PAGE(hot_pair), 2 * i + 1);
+        }
+    }
+    return value;
+}
+
+// octet du support tel qu'il est en flash (sans le cache)
+static uint8_t flash_virtual_byte(uint16_t addr) {
+    if (addr < SPM_PAGESIZE) {
+        return flash_hot_byte((uint8_t)addr);
+    }
+    return flash_byte(DATA_BASE, addr);
+}
+
+// @return 1 si le mot 0 du journal de la paire est un marqueur complet
+static uint8_t flash_journal_valid(uint8_t pair, uint8_t* seq) {
+    *seq = flash_byte(HOT_JOURNAL_PAGE(pair), 0);
+    return (uint8_t)(flash_byte(HOT_JOURNAL_PAGE(pair), 1) ^ *seq) == 0xFF;
+}
+
+// ouvre un journal vide pour la paire: seul le marqueur est programme, le
+// reste de la page efface vaut JOURNAL_EMPTY
+static void flash_journal_open(uint8_t pair, uint8_t seq) {
+    uint16_t addr = STORAGE_FLASH_START + HOT_JOURNAL_PAGE(pair);
+
+    UART__rx_hold();
+    flash_spm_erase(addr);
+    flash_spm_fill(addr, seq | ((uint16_t)(uint8_t)~seq << 8));
+    flash_spm_write(addr);
+    UART__rx_resume();
+    stats_storage_bytes(2);
+    hot_pair = pair;
+    hot_seq = seq;
+    hot_used = 1;
+}
+
+// ajoute un mot au journal courant, qui doit avoir une place libre
+static void flash_journal_append(uint8_t offset, uint8_t value) {
+    uint16_t journal = STORAGE_FLASH_START + HOT_JOURNAL_PAGE(hot_pair);
+
+    UART__rx_hold();
+    flash_spm_fill(journal + 2 * hot_used, offset | ((uint16_t)value << 8));
+    flash_spm_write(journal);
+    UART__rx_resume();
+    stats_storage_bytes(2);
+    hot_used++;
+}
+
+// Repli de la premiere page telle qu'elle est en flash (copie recouverte par
+// le journal) dans l'autre copie, sans passer par le cache
+static void flash_fold_hot(void) {
+    uint8_t next = hot_pair ^ 1;
+    uint16_t addr = STORAGE_FLASH_START + HOT_COPY_PAGE(next);
+
+    UART__rx_hold();
+    flash_spm_erase(addr);
+    for (uint8_t i = 0; i < SPM_PAGESIZE; i += 2) {
+        flash_spm_fill(addr + i, flash_hot_byte(i) | ((uint16_t)flash_hot_byte(i + 1) << 8));
+    }
+    flash_spm_write(addr);
+    UART__rx_resume();
+    stats_storage_bytes(SPM_PAGESIZE);
+    flash_journal_open(next, hot_seq + 1);
+}
+
+// Programme une page du journal de credentials via la page de transit: une
+// coupure a n'importe quel moment laisse l'ancienne page ou la nouvelle
+static void flash_program_staged(uint16_t page, const uint8_t* buffer) {
+    // deux mots de journal pour la cible et la fin de la copie
+    if (JOURNAL_WORDS - hot_used < 2) {
+        flash_fold_hot();
+    }
+    uint8_t number = (uint8_t)(page / SPM_PAGESIZE);
+    flash_program_page(STAGE_PAGE, buffer);
+    flash_journal_append(JOURNAL_STAGE + number, (uint8_t)~number);
+    flash_program_page(page, buffer);
+    flash_journal_append(JOURNAL_STAGE_DONE, 0);
+}
+
+// Ecrit la premiere page en cache: dans le journal si ses modifications y
+// tiennent, sinon repli dans l'autre copie.
+static void flash_sync_hot(void) {
+    uint8_t changed = 0;
+    for (uint8_t i = 0; i < SPM_PAGESIZE; i++) {
+        changed += page_buffer[i] != flash_hot_byte(i);
+    }
+    if (changed == 0) return;
+
+    if (changed <= JOURNAL_WORDS - hot_used) {
+        uint16_t journal = STORAGE_FLASH_START + HOT_JOURNAL_PAGE(hot_pair);
+        uint8_t used = hot_used;
+        UART__rx_hold();
+        for (uint8_t i = 0; i < SPM_PAGESIZE; i++) {
+            if (page_buffer[i] != flash_hot_byte(i)) {
+                flash_spm_fill(journal + 2 * used, i | ((uint16_t)page_buffer[i] << 8));
+                used++;
+            }
+        }
+        flash_spm_write(journal);
+        UART__rx_resume();
+        stats_storage_bytes(2 * changed);
+        hot_used = used;
+        return;
+    }
+
+    uint8_t next = hot_pair ^ 1;
+    flash_program_page(HOT_COPY_PAGE(next), page_buffer);
+    flash_journal_open(next, hot_seq + 1);
+}
+
+static void flash_backend_sync(void) {
+    if (!page_dirty) return;
+    if (page_addr == 0) {
+        flash_sync_hot();
+    } else if (memcmp_P(page_buffer, (const void*)(uintptr_t)(STORAGE_FLASH_START + DATA_BASE + page_addr),
+                        SPM_PAGESIZE) != 0) {
+        // si rien n'a change (ecriture d'octets deja en place), on n'use pas la page
+        flash_program_staged(DATA_BASE + page_addr, page_buffer);
+    }
+    page_dirty = 0;
+    flash_written += page_pending;
+    page_pending = 0;
+}
+
+static void flash_backend_load_page(uint16_t addr) {
+    uint16_t page = addr & ~(uint16_t)(SPM_PAGESIZE - 1);
+    if (page == page_addr) return;
+    flash_backend_sync();
+    for (uint16_t i = 0; i < SPM_PAGESIZE; i++) {
+        page_buffer[i] = flash_virtual_byte(page + i);
+    }
+    page_addr = page;
+}
+
+// copie interrompue par une coupure: la page de transit est complete (sa cible
+// n'est notee qu'apres), on la recopie dans la cible
+static void flash_stage_recover(void) {
+    uint8_t target = NO_STAGE;
+    for (uint8_t i = 1; i < hot_used; i++) {
+        uint8_t offset = flash_byte(HOT_JOURNAL_PAGE(hot_pair), 2 * i);
+        uint8_t value = flash_byte(HOT_JOURNAL_PAGE(hot_pair), 2 * i + 1);
+        if (offset >= JOURNAL_STAGE && offset < JOURNAL_STAGE_DONE) {
+            // mot interrompu: la cible n'a pas encore ete touchee, rien a refaire
+            uint8_t number = offset - JOURNAL_STAGE;
+            target = (uint8_t)(value ^ number) == 0xFF ? number : NO_STAGE;
+        } else if (offset == JOURNAL_STAGE_DONE) {
+            target = NO_STAGE;
+        }
+    }
+    if (target == NO_STAGE) return;
+
+    memcpy_P(page_buffer, (const void*)(uintptr_t)(STORAGE_FLASH_START + STAGE_PAGE), SPM_PAGESIZE);
+    flash_program_page((uint16_t)target * SPM_PAGESIZE, page_buffer);
+    // place reservee par flash_program_staged
+    flash_journal_append(JOURNAL_STAGE_DONE, 0);
+}
+
+// paire courante: journal au marqueur valide le plus recent, journal 0 neuf
+// sur une flash vierge
+static void flash_backend_init(void) {
+    uint8_t seq0, seq1;
+    uint8_t valid0 = flash_journal_valid(0, &seq0);
+    uint8_t valid1 = flash_journal_valid(1, &seq1);
+
+    page_addr = NO_PAGE;
+    page_dirty = 0;
+    if (!valid0 && !valid1) {
+        flash_journal_open(0, 0);
+        return;
+    }
+    hot_pair = (valid1 && (!valid0 || (int8_t)(seq1 - seq0) > 0)) ? 1 : 0;
+    hot_seq = hot_pair ? seq1 : seq0;
+    hot_used = 1;
+    while (hot_used < JOURNAL_WORDS && flash_byte(HOT_JOURNAL_PAGE(hot_pair), 2 * hot_used) != JOURNAL_EMPTY) {
+        hot_used++;
+    }
+    flash_stage_recover();
+}
+
+static uint16_t flash_backend_size(void) {
+    return VIRTUAL_SIZE;
+}
+
+static void flash_backend_read(void* dst, uint16_t addr, uint16_t len) {
+    uint8_t* out = (uint8_t*)dst;
+    for (uint16_t i = 0; i < len; i++, addr++) {
+        if ((addr & ~(uint16_t)(SPM_PAGESIZE - 1)) == page_addr) {
+            out[i] = page_buffer[addr & (SPM_PAGESIZE - 1)];
+        } else {
+            out[i] = flash_virtual_byte(addr);
+        }
+    }
+}
+
+static void flash_backend_write(const void* src, uint16_t addr, uint16_t len) {
+    const uint8_t* bytes = (const uint8_t*)src;
+    for (uint16_t i = 0; i < len; i++, addr++) {
+        flash_backend_load_page(addr);
+        page_buffer[addr & (SPM_PAGESIZE - 1)] = bytes[i];
+        page_dirty = 1;
+        page_pending++;
+    }
+}
+
+// la programmation est synchrone: seul le cache peut etre en attente
+static uint8_t flash_backend_busy(void) {
+    return page_dirty;
+}
+
+static uint16_t flash_backend_written(void) {
+    return flash_written;
+}
+
+const StorageBackend storage_backend_flash = {
+    .init = flash_backend_init,
+    .size = flash_backend_size,
+    .read = flash_backend_read,
+    .write = flash_backend_write,
+    .sync = flash_backend_sync,
+    .busy = flash_backend_busy,
+    .flush = flash_backend_sync,
+    .written = flash_backend_written
+};
@@ -0,0 +1,15 @@
+#include <stdio.h>
+
+#include "storage.h"
+
+// Outil hote (make host): ouvre le stockage de storage_file.c avec storage.c,
+// comme au demarrage de l'authenticator, et affiche son etat. Le fichier est
+// formate s'il est neuf. Ce module n'est pas compile pour l'AVR.
+int main(void) {
+    storage_init();
+    printf("credentials: %u / %u\n", storage_count(), storage_capacity());
+    printf("generation: %u\n", storage_epoch());
+    printf("slots a effacer: %u\n", storage_scrub_remaining());
+    storage_flush();
+    return 0;
+}
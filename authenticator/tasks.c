@@ -0,0 +1,54 @@
+#include "tasks.h"
+#include "clock.h"
+#include "uart.h"
+#include "rng.h"
+#include "storage.h"
+#include "commands.h"
+
+// effacement des cles d'une ancienne generation, un slot a la fois, une fois
+// les ecritures en cours faites (l'ISR EE_READY reveille le cpu d'ici la)
+static uint8_t task_scrub(void) {
+    if (storage_busy()) return 0;
+    return storage_scrub_step();
+}
+
+static uint32_t last_command_us;
+
+void tasks_command(void) {
+    last_command_us = clock_us();
+}
+
+// uECC_make_key ne se decoupe pas: le calcul bloque la boucle quelques
+// centaines de ms. Il n'est lance qu'apres TASKS_KEY_IDLE_US sans commande,
+// quand une session est vraisemblablement finie; une commande qui arrive
+// pendant le calcul attend sa fin.
+static uint8_t task_precompute_key(void) {
+    if (clock_us() - last_command_us < TASKS_KEY_IDLE_US) return 0;
+    return commands_precompute_key();
+}
+
+// Etapes des taches, par priorite decroissante
+// @return 1 s'il leur reste du travail
+static uint8_t (* const tasks[])(void) = {
+    task_scrub,
+    rng_pool_refill,      // une mesure lancee ou lue par etape
+    task_precompute_key,  // d'un bloc, en dernier
+};
+
+#define TASK_COUNT (sizeof(tasks) / sizeof(tasks[0]))
+
+uint8_t tasks_run(void) {
+    uint32_t start = clock_us();
+
+    for (uint8_t i = 0; i < TASK_COUNT; i++) {
+        while (tasks[i]()) {
+            if (UART__rx_pending() || clock_us() - start >= TASKS_SLICE_US) {
+                return 1;
+            }
+        }
+        if (UART__rx_pending()) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+#include <stdint.h>
+
+// Taches de fond cooperatives, servies par la boucle principale quand aucun
+// octet recu n'attend. Chaque etape fait un morceau de travail et rend la
+// main: une commande qui arrive passe avant la suite.
+
+// duree d'une tranche (us), verifiee entre deux etapes
+#ifndef TASKS_SLICE_US
+#define TASKS_SLICE_US 2000UL
+#endif
+
+// delai sans commande avant de calculer la paire de cles d'avance (us)
+#ifndef TASKS_KEY_IDLE_US
+#define TASKS_KEY_IDLE_US 5000000UL
+#endif
+
+// Note la derniere commande recue (la boucle principale l'appelle)
+void tasks_command(void);
+
+// Une tranche: les taches sont servies par priorite, la premiere qui a du
+// travail garde la main jusqu'a la fin de la tranche
+// @return 1 s'il reste du travail (la boucle ne doit pas dormir)
+uint8_t tasks_run(void);
+
+#endif // TASKS_H
@@ -0,0 +1,41 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "trace.h"
+#include "clock.h"
+
+_Static_assert((TRACE_ENTRIES & (TRACE_ENTRIES - 1)) == 0 && TRACE_ENTRIES <= 128, "TRACE_ENTRIES");
+
+static TraceEntry trace_entries[TRACE_ENTRIES];
+static uint8_t trace_head = 0; // prochaine entree ecrite
+static uint8_t trace_len = 0;
+
+void trace_record(uint8_t event, uint8_t arg) {
+    uint8_t sreg = SREG;
+    cli();
+    TraceEntry* entry = &trace_entries[trace_head];
+    entry->event = event;
+    entry->arg = arg;
+    entry->time_us = clock_us();
+    trace_head = (trace_head + 1) & (TRACE_ENTRIES - 1);
+    if (trace_len < TRACE_ENTRIES) {
+        trace_len++;
+    }
+    SREG = sreg;
+}
+
+uint8_t trace_pop(TraceEntry* entry) {
+    uint8_t found = 0;
+    cli();
+    if (trace_len) {
+        *entry = trace_entries[(uint8_t)(trace_head - trace_len) & (TRACE_ENTRIES - 1)];
+        trace_len--;
+        found = 1;
+    }
+    sei();
+    return found;
+}
+
+uint8_t trace_count(void) {
+    return trace_len;
+}
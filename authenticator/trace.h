@@ -0,0 +1,29 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Journal des phases des commandes (evenements TRACE_* de consts.h), date par
+// clock_us et exporte par GET_TRACE. Les plus anciens sont ecrases quand il
+// est plein. Taille en puissance de 2.
+#ifndef TRACE_ENTRIES
+#define TRACE_ENTRIES 16
+#endif
+
+typedef struct {
+    uint8_t event;
+    uint8_t arg;     // opcode pour TRACE_RECEIVED, statut ou etat sinon
+    uint32_t time_us;
+} TraceEntry;
+
+// Ajoute un evenement (appelable depuis une ISR)
+void trace_record(uint8_t event, uint8_t arg);
+
+// Retire le plus ancien evenement
+// @return 0 si le journal est vide
+uint8_t trace_pop(TraceEntry* entry);
+
+// Nombre d'evenements dans le journal
+uint8_t trace_count(void);
+
+#endif // TRACE_H
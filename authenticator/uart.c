@@ -1,54 +1,193 @@
 #include "uart.h"
 #include "ring_buffer.h"
+#include "consts.h"
+#include "trace.h"
+#include "clock.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
 
 #define FOSC 16000000UL
-#define BAUD 115200
-#define UBRR ((FOSC/16/BAUD)- 1)
+// En double vitesse (U2X0) l'horloge de l'USART vaut FOSC/8, ce qui donne un
+// UBRR deux fois plus fin et arrondi: a 115200 l'erreur passe de +8.5% (UBRR=7,
+// division entiere en vitesse normale, soit 125000 bauds) a +2.1% (UBRR=16), et
+// 250k/500k/1M tombent juste (UBRR = 7, 3, 1).
+#define UBRR(baud) ((FOSC + 4 * (baud)) / (8 * (baud)) - 1)
+// tailles en puissances de 2 (masque dans ring_buffer.c), 128 au plus
 #define BUFFER_SIZE 128
+#define TX_BUFFER_SIZE 64
+_Static_assert((BUFFER_SIZE & (BUFFER_SIZE - 1)) == 0 && BUFFER_SIZE <= 128, "BUFFER_SIZE");
+_Static_assert((TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) == 0 && TX_BUFFER_SIZE <= 128, "TX_BUFFER_SIZE");
+
+// Controle de flux RTS/CTS: l'ISR de reception leve RTS quand le buffer atteint
+// RX_HIGH_WATER, et il n'est baisse qu'une fois la lecture redescendue a
+// RX_LOW_WATER. La marge au-dessus de RX_HIGH_WATER couvre les octets que
+// l'adaptateur envoie encore avant de voir CTS (fifo, latence USB).
+#define RX_HIGH_WATER (BUFFER_SIZE - 32)
+#define RX_LOW_WATER (BUFFER_SIZE / 4)
 
 static uint8_t uart_rx_buffer[BUFFER_SIZE];
 static struct ring_buffer rx_buffer;
+// octets a envoyer, vides par l'ISR USART_UDRE: UART__putbyte rend la main
+// tout de suite tant que le buffer n'est pas plein
+static uint8_t uart_tx_buffer[TX_BUFFER_SIZE];
+static struct ring_buffer tx_buffer;
+static volatile uint8_t tx_active = 0; // octets en file ou en cours d'envoi
+static uint32_t uart_baud = UART_DEFAULT_BAUD;
+static uint8_t rx_held = 0; // RTS leve par UART__rx_hold
 
-void UART__init(){
+// octets que l'hote peut encore envoyer apres avoir vu RTS (fifo de l'adaptateur)
+#define RX_HOLD_BYTES 4
+
+void UART__set_baud(uint32_t baud) {
+    uint16_t ubrr = UBRR(baud);
     // set baud rate dans registre ubrr0
-    UBRR0H = (unsigned char)(UBRR >> 8);
-    UBRR0L = (unsigned char)UBRR;
+    UBRR0H = (unsigned char)(ubrr >> 8);
+    UBRR0L = (unsigned char)ubrr;
+    UCSR0A |= (1 << U2X0);
+    uart_baud = baud;
+}
+
+uint32_t UART__get_baud(void) {
+    return uart_baud;
+}
+
+// cote lecture: relache RTS une fois le buffer assez vide
+static void uart_rx_release(void) {
+    if (!rx_held && (RTS_PORT & (1 << RTS_NUM)) && ring_buffer__available(&rx_buffer) <= RX_LOW_WATER) {
+        cli();
+        RTS_PORT &= ~(1 << RTS_NUM);
+        sei();
+    }
+}
+
+void UART__clear_rx(void) {
+    ring_buffer__clear(&rx_buffer);
+    uart_rx_release();
+}
+
+void UART__rx_hold(void) {
+    rx_held = 1;
+    cli();
+    RTS_PORT |= (1 << RTS_NUM);
+    sei();
+    // les octets deja en route arrivent pendant l'attente (10 bits par octet)
+    uint32_t start = clock_us();
+    uint32_t wait_us = RX_HOLD_BYTES * 10 * 1000000UL / uart_baud;
+    while (clock_us() - start < wait_us);
+}
+
+void UART__rx_resume(void) {
+    rx_held = 0;
+    uart_rx_release();
+}
+
+uint16_t UART__rx_overflows(void) {
+    uint16_t copy;
+    cli();
+    copy = rx_buffer.overflows;
+    sei();
+    return copy;
+}
+
+void UART__init(){
+    UART__set_baud(UART_DEFAULT_BAUD);
     // active tx transmission, rx reception et rx interrupt
     UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0);
     // 8 bits de data et 1 bit stop sans bit de parité
     UCSR0C = (1 << UCSZ01) | (1 << UCSZ00);
+    // RTS en sortie, bas: pret a recevoir
+    RTS_PORT &= ~(1 << RTS_NUM);
+    RTS_DDR |= (1 << RTS_NUM);
     // init le buffer et les interruptions
     ring_buffer__init(&rx_buffer, uart_rx_buffer, BUFFER_SIZE);
+    ring_buffer__init(&tx_buffer, uart_tx_buffer, TX_BUFFER_SIZE);
     // mode sleep et interruptions globales
     set_sleep_mode(SLEEP_MODE_IDLE);
     sei();
 }
 
 uint8_t UART__getbyte(uint8_t* data) {
-    return ring_buffer__pop(&rx_buffer, data);
+    uint8_t empty = ring_buffer__pop(&rx_buffer, data);
+    uart_rx_release();
+    return empty;
+}
+
+uint8_t UART__read(uint8_t* data, uint8_t length) {
+    uint8_t count = ring_buffer__pop_n(&rx_buffer, data, length);
+    uart_rx_release();
+    return count;
+}
+
+uint8_t UART__rx_pending(void) {
+    return !ring_buffer__empty(&rx_buffer);
 }
 
 
 void UART__putbyte(uint8_t data) {
-    while (!(UCSR0A & (1 << UDRE0)));
-    UDR0 = data;
+    // buffer plein: le cpu dort pendant que l'ISR envoie
+    cli();
+    while (ring_buffer__full(&tx_buffer)) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    ring_buffer__push(&tx_buffer, data);
+    tx_active = 1;
+    UCSR0B |= (1 << UDRIE0);
+    sei();
 }
 
+// attendre que tous les octets soient sortis (bit stop du dernier compris)
+void UART__flush(void) {
+    cli();
+    while (tx_active) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+        cli();
+    }
+    sei();
+}
+
+// registre d'envoi libre: octet suivant, ou attente de la fin du dernier envoi
+ISR(USART_UDRE_vect) {
+    uint8_t c;
+    if (ring_buffer__pop(&tx_buffer, &c) == 0) {
+        UDR0 = c;
+    } else {
+        UCSR0B = (UCSR0B & ~(1 << UDRIE0)) | (1 << TXCIE0);
+    }
+}
+
+ISR(USART_TX_vect) {
+    if (ring_buffer__empty(&tx_buffer)) {
+        tx_active = 0;
+        UCSR0B &= ~(1 << TXCIE0);
+        trace_record(TRACE_TX_DONE, 0);
+    }
+}
 
+// buffer plein: l'octet est perdu et compte dans rx_buffer.overflows
+// (l'hote ignore RTS ou n'a pas de CTS cable)
 ISR(USART_RX_vect) {
     uint8_t c = UDR0;
     ring_buffer__push(&rx_buffer, c);
+    if (ring_buffer__available(&rx_buffer) >= RX_HIGH_WATER) {
+        RTS_PORT |= (1 << RTS_NUM);
+    }
 }
 
 // dormir en attendant de recevoir des donnees
 void UART__sleep(void) {
     cli();
     // si y'a plus de données dans le buffer -> pas de commandes recues donc on dort
-    if (rx_buffer.head ==rx_buffer.tail) {
+    if (ring_buffer__empty(&rx_buffer)) {
         sleep_enable();
+        sei(); // l'instruction suivant sei est executee avant toute interruption
         sleep_cpu();
         sleep_disable();
     } else {
@@ -3,9 +3,29 @@
 
 #include <stdint.h>
 
+// debit au demarrage, change ensuite par SET_BAUD
+#define UART_DEFAULT_BAUD 115200UL
+
 void UART__init(void);
+// passe en double vitesse (U2X0) au debit <baud>, UBRR arrondi au plus proche
+void UART__set_baud(uint32_t baud);
+uint32_t UART__get_baud(void);
+// oublie les octets recus pas encore lus
+void UART__clear_rx(void);
 uint8_t UART__getbyte(uint8_t *data);
+// copie jusqu'a <length> octets recus, @return le nombre copie
+uint8_t UART__read(uint8_t *data, uint8_t length);
+// @return 1 si des octets recus attendent d'etre lus
+uint8_t UART__rx_pending(void);
+// Leve RTS et attend que les octets deja envoyes par l'hote soient recus, avant
+// une operation qui coupe les interruptions plusieurs ms (programmation flash).
+// Sans RTS/CTS cable, les octets recus pendant l'operation sont perdus.
+void UART__rx_hold(void);
+void UART__rx_resume(void);
+// octets perdus car recus avec le buffer de reception plein
+uint16_t UART__rx_overflows(void);
 void UART__putbyte(uint8_t data);
+void UART__flush(void);
 void UART__sleep(void);
 
 #endif
@@ -1,5 +1,6 @@
 #include "ui.h"
 #include "consts.h"
+#include "stats.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <stdint.h>
@@ -8,18 +9,125 @@
 #define F_CPU 16000000UL
 
 static volatile uint16_t g_ms_tick = 0;
-static volatile uint8_t g_button_confirmed = 0;
 static volatile uint8_t g_led_pwm = 0;
 
-// ISR avec timer0
+// Le timer0 ne tourne que si quelqu'un en a besoin: au repos le cpu dort
+// jusqu'a l'UART ou au bouton au lieu d'etre reveille toutes les ms
+#define UI_TICK_CONSENT  0x01 // clignotement, debounce et timeout du consentement
+#define UI_TICK_PRESENCE 0x02 // decompte et led de la fenetre de presence
+#define UI_TICK_TIMEOUT  0x04 // attente avec delai (ui_timeout_begin)
+static volatile uint8_t g_tick_users = 0;
+static uint8_t g_timeout_depth = 0; // ui_timeout_begin imbriques
+
+// etat de la demande de consentement, gere par l'ISR timer0
+static volatile uint8_t g_consent_state = UI_CONSENT_DENIED;
+static volatile uint16_t g_consent_elapsed = 0;  // temps depuis ui_consent_begin
+static volatile uint16_t g_blink_elapsed = 0;    // temps depuis dernier toggle led
+static volatile uint8_t g_debounce_left = 0;     // debounce en cours apres un front sur INT0 (0 = aucun)
+static volatile uint8_t g_button_armed = 0;      // bouton vu relache depuis ui_consent_begin
+static volatile uint8_t g_led_on = 0;
+static volatile uint8_t g_presence_seconds = 0; // 0 = pas de fenetre de presence
+static volatile uint16_t g_presence_ms = 0;
+
+// led eteinte, ou faible si une fenetre de presence est ouverte
+static uint8_t ui_led_idle_duty(void) {
+    return g_presence_seconds ? PRESENCE_LED_DUTY : 0;
+}
+
+// 1 = bouton appuye (pull-up, actif a l'etat bas), 0 relache
+static uint8_t ui_button_is_pressed_raw(void) {
+    return (BUTTON_PIN & (1 << BUTTON_NUM)) == 0;
+}
+
+// demarre le timer0 pour <user> (interruptions coupees)
+static void ui_tick_use(uint8_t user) {
+    if (g_tick_users == 0) {
+        TCNT0 = 0;
+        TIFR0 = (1 << TOV0);
+        TCCR0A |= (1 << COM0A1);
+        TCCR0B = (1 << CS01) | (1 << CS00);
+    }
+    g_tick_users |= user;
+}
+
+// arrete le timer0 si plus personne n'en a besoin (interruptions coupees)
+static void ui_tick_release(uint8_t user) {
+    g_tick_users &= ~user;
+    if (g_tick_users == 0) {
+        // OC0A deconnecte: la led suit PORT et reste eteinte timer arrete
+        TCCR0B = 0;
+        TCCR0A &= ~(1 << COM0A1);
+    }
+}
+
+// fin de la demande de consentement (interruptions coupees). Accordee, elle
+// garde le timer0 jusqu'a ui_consent_done: la led ne s'eteint pas avant que
+// la fenetre de presence eventuelle soit ouverte
+static void ui_consent_end(uint8_t state) {
+    g_consent_state = state;
+    EIMSK &= ~(1 << INT0);
+    if (state != UI_CONSENT_GRANTED) {
+        ui_tick_release(UI_TICK_CONSENT);
+    }
+}
+
+// un pas (~1ms) de la demande de consentement: clignotement, debounce et timeout
+// appele depuis l'ISR pour que le calcul crypto puisse tourner en meme temps
+static void ui_consent_tick(void) {
+    g_consent_elapsed++;
+    g_blink_elapsed++;
+
+    if (g_blink_elapsed >= LED_BLINK_INTERVAL_MS) {
+        g_blink_elapsed = 0;
+        g_led_on = !g_led_on;
+        OCR0A = g_led_on ? 255 : 0;
+    }
+
+    // fin du debounce lance par le dernier front: un relachement stable arme le
+    // bouton, l'appui suivant compte s'il tient encore. Un bouton deja tenu (ou
+    // bloque) au debut de la demande doit donc etre relache d'abord
+    if (g_debounce_left && --g_debounce_left == 0) {
+        if (!ui_button_is_pressed_raw()) {
+            g_button_armed = 1;
+        } else if (g_button_armed) {
+            OCR0A = 255;
+            ui_consent_end(UI_CONSENT_GRANTED); // consentement donné
+            return;
+        }
+    }
+
+    if (g_consent_elapsed >= CONSENT_TIMEOUT_MS) {
+        stats_consent_timeout();
+        OCR0A = ui_led_idle_duty();
+        ui_consent_end(UI_CONSENT_DENIED);
+    }
+}
+
+// ISR avec timer0, seulement quand g_tick_users != 0
 ISR(TIMER0_OVF_vect) {
     g_ms_tick++;
+    if (g_consent_state == UI_CONSENT_PENDING) {
+        ui_consent_tick();
+    }
+    if (g_presence_seconds && ++g_presence_ms >= 1000) {
+        g_presence_ms = 0;
+        if (--g_presence_seconds == 0) {
+            if (g_consent_state != UI_CONSENT_PENDING) {
+                OCR0A = 0;
+            }
+            ui_tick_release(UI_TICK_PRESENCE);
+        }
+    }
 }
 
+// front sur le bouton (active pendant une demande de consentement): chaque
+// rebond relance le debounce, decompte ensuite par l'ISR timer0
 ISR(INT0_vect) {
+    g_debounce_left = BUTTON_DEBOUNCE_MS;
 }
 
-// ms écoulées depuis reset compteur
+// ms écoulées pendant que le timer0 tourne (entre ui_timeout_begin et
+// ui_timeout_end pour mesurer un delai)
 uint16_t ui_get_ms(void) {
     uint16_t copy;
     cli();
@@ -28,40 +136,29 @@ uint16_t ui_get_ms(void) {
     return copy;
 }
 
-// Reset compteur ms
-static void ui_reset_ms(void) {
-    cli();
-    g_ms_tick = 0;
-    sei();
-}
-
-// 0 = bouton appuye, 1 relache
-static uint8_t ui_button_is_pressed_raw(void) {
-    return (BUTTON_PIN & (1 << BUTTON_NUM)) == 0;
-}
-
 // Initialisation UI: LED + bouton + Timer0 PWM + Timer0 overflow + INT0
 void ui_init(void) {
     LED_DDR |= (1 << LED_PIN);
     BUTTON_DDR &= ~(1 << BUTTON_NUM);
     BUTTON_PORT |= (1 << BUTTON_NUM);
-    // Configurer Timer0 en Fast PWM, non-inverting sur OC0A, prescaler 64
-    TCCR0A = (1 << WGM01) | (1 << WGM00) | (1 << COM0A1);
-    TCCR0B = (1 << CS01) | (1 << CS00);
+    // Configurer Timer0 en Fast PWM, non-inverting sur OC0A, prescaler 64 une
+    // fois demarre par ui_tick_use: arrete au repos
+    TCCR0A = (1 << WGM01) | (1 << WGM00);
+    TCCR0B = 0;
     // led etteinte
     OCR0A = 0;
     TIMSK0 |= (1 << TOIE0);
-    // Configurer INT0 sur front descendant (bouton)
-    EICRA |= (1 << ISC01);
-    EIMSK |= (1 << INT0);
+    // Configurer INT0 sur les deux fronts (bouton), active pendant le consentement
+    EICRA = (EICRA & ~(1 << ISC01)) | (1 << ISC00);
     sei();
 }
 
 
-// on dort jusqu'au prochain tick Timer0 ou interr
+// on dort jusqu'au prochain tick Timer0 ou interr (sans dormir si le timer0
+// vient de s'arreter: plus aucun tick ne viendrait reveiller le cpu)
 void ui_sleep_tick(uint16_t last_ms) {
     cli();
-    if (g_ms_tick == last_ms) {
+    if (g_tick_users && g_ms_tick == last_ms) {
         sleep_enable();
         sei();
         sleep_cpu();
@@ -72,65 +169,89 @@ void ui_sleep_tick(uint16_t last_ms) {
 }
 
 
-// on att le consentement = qu'on appuie sur boutton
-// pdt ce tps on fait clignoter la led a 1Hz = 500ms on + 500ms off
-uint8_t ui_wait_for_consent(void) {
-    uint16_t last_ms = 0;
-    uint16_t blink_elapsed = 0; // temps depuis dernier toggle led
-    uint16_t debounce_elapsed = 0; // temps depuis changement etat bouton
-    uint8_t  led_on = 0;
-    uint8_t  last_button_state = ui_button_is_pressed_raw();
+// demarre la demande de consentement: la led clignote a 1Hz (500ms on + 500ms off)
+// et le bouton est surveille par l'ISR timer0, le programme peut continuer a calculer
+void ui_consent_begin(void) {
+    cli();
+    g_consent_elapsed = 0;
+    g_blink_elapsed = 0;
+    // bouton deja tenu: il faudra un relachement puis un nouvel appui
+    g_debounce_left = 0;
+    g_button_armed = !ui_button_is_pressed_raw();
+    g_led_on = 1;
+    OCR0A = 255; //itensite max
+    g_consent_state = UI_CONSENT_PENDING;
+    EIFR = (1 << INTF0);
+    EIMSK |= (1 << INT0);
+    ui_tick_use(UI_TICK_CONSENT);
+    sei();
+}
 
-    g_button_confirmed = 0;
-    ui_reset_ms();
-    last_ms = ui_get_ms();
+uint8_t ui_consent_poll(void) {
+    return g_consent_state;
+}
 
-    led_on = 1;
-    OCR0A = 255; //itensite max
+void ui_consent_done(void) {
+    cli();
+    if (g_consent_state != UI_CONSENT_PENDING) {
+        OCR0A = ui_led_idle_duty();
+        ui_tick_release(UI_TICK_CONSENT);
+    }
+    sei();
+}
 
-    while (ui_get_ms() < CONSENT_TIMEOUT_MS) {
-        uint16_t now = ui_get_ms();
-        uint16_t delta = now - last_ms;
-        if (delta == 0) {
-            ui_sleep_tick(last_ms);
-            continue;
-        }
-        last_ms = now;
-        blink_elapsed += delta;
-        debounce_elapsed += delta;
-
-        if (blink_elapsed >= 500) {
-            blink_elapsed = 0;
-            led_on = !led_on;
-            if (led_on) {
-                OCR0A = 255;
-            } else {
-                OCR0A = 0;
-            }
-        }
+// refuse la demande en cours sans attendre le timeout (CANCEL)
+uint8_t ui_consent_cancel(void) {
+    uint8_t cancelled = 0;
+    cli();
+    if (g_consent_state == UI_CONSENT_PENDING) {
+        OCR0A = ui_led_idle_duty();
+        ui_consent_end(UI_CONSENT_DENIED);
+        cancelled = 1;
+    }
+    sei();
+    return cancelled;
+}
 
-        // on regarde le bouton (lit etat et debounce)
-        // si etat change on reset debounce, sinon on valide l'appuie bouton
-        uint8_t cur_state = ui_button_is_pressed_raw();
-        if (cur_state != last_button_state) {
-            last_button_state = cur_state;
-            debounce_elapsed = 0;
-        } else {
-            if (cur_state == 0 && debounce_elapsed >= 20) {
-                g_button_confirmed = 1;
-            }
-        }
+void ui_presence_open(uint8_t seconds) {
+    cli();
+    g_presence_seconds = seconds;
+    g_presence_ms = 0;
+    OCR0A = ui_led_idle_duty();
+    if (seconds) {
+        ui_tick_use(UI_TICK_PRESENCE);
+    } else {
+        ui_tick_release(UI_TICK_PRESENCE);
+    }
+    sei();
+}
 
-        if (g_button_confirmed) {
-            OCR0A = 255;
-            return 1; // consentement donné
-        }
+void ui_presence_close(void) {
+    cli();
+    g_presence_seconds = 0;
+    if (g_consent_state != UI_CONSENT_PENDING) {
+        OCR0A = 0;
+    }
+    ui_tick_release(UI_TICK_PRESENCE);
+    sei();
+}
 
-        // on dort jusquau prochain tick ou bouton
-        ui_sleep_tick(last_ms);
+void ui_timeout_begin(void) {
+    cli();
+    if (g_timeout_depth++ == 0) {
+        ui_tick_use(UI_TICK_TIMEOUT);
     }
+    sei();
+}
 
+void ui_timeout_end(void) {
+    cli();
+    if (--g_timeout_depth == 0) {
+        ui_tick_release(UI_TICK_TIMEOUT);
+    }
+    sei();
+}
 
-    OCR0A = 0;
-    return 0;
+uint8_t ui_presence_active(void) {
+    return g_presence_seconds != 0;
 }
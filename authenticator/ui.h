@@ -3,10 +3,34 @@
 
 #include <stdint.h>
 
+// etats d'une demande de consentement
+#define UI_CONSENT_PENDING 0
+#define UI_CONSENT_GRANTED 1
+#define UI_CONSENT_DENIED  2
+
 void ui_init(void);
-uint8_t ui_wait_for_consent(void);
+void ui_consent_begin(void);
+uint8_t ui_consent_poll(void);
+// Demande aboutie et traitee (fenetre de presence ouverte s'il y a lieu): la
+// led revient au repos et le timer0 s'arrete si plus rien ne l'utilise
+void ui_consent_done(void);
+// @return 1 si une demande en cours a ete refusee, 0 si elle avait deja abouti
+uint8_t ui_consent_cancel(void);
 void ui_sleep_tick(uint16_t last_ms);
 uint16_t ui_get_ms(void);
 
+// Le timer0 (tick ms et PWM de la led) est arrete au repos. Une attente avec
+// delai (ui_get_ms, ui_sleep_tick) doit etre encadree par ces deux appels, qui
+// peuvent s'imbriquer. La demande de consentement et la fenetre de presence
+// gardent le timer0 en marche d'elles-memes.
+void ui_timeout_begin(void);
+void ui_timeout_end(void);
+
+// Fenetre de presence: decomptee par l'ISR timer0 et montree par la led a
+// PRESENCE_LED_DUTY, elle se ferme seule au bout de <seconds> secondes
+void ui_presence_open(uint8_t seconds);
+void ui_presence_close(void);
+uint8_t ui_presence_active(void);
+
 
 #endif
@@ -10,12 +10,14 @@ import logging
 
 DEVICE="/dev/ttyACM0"
 BAUD_RATE=115200
+# set when the device RTS (PD4) is wired to the CTS of the serial adapter
+RTSCTS=False
 
 class TestDevice(unittest.TestCase):
 
     def setUp(self):
         logging.disable(logging.CRITICAL)
-        self.device = serial.Serial(port=DEVICE, baudrate=BAUD_RATE, exclusive=True)
+        self.device = serial.Serial(port=DEVICE, baudrate=BAUD_RATE, rtscts=RTSCTS, exclusive=True)
         # Give the mcu some time to restart
         time.sleep(2)
 
@@ -29,6 +31,17 @@ class TestDevice(unittest.TestCase):
         entries = yubino.device.list_credentials(self.device)
         self.assertEqual(len(entries), 0)
 
+    def test_reset_scrub(self):
+        yubino.device.reset(self.device)
+        yubino.device.make_credential(self.device, "toto")
+        yubino.device.reset(self.device)
+        self.assertEqual(len(yubino.device.list_credentials(self.device)), 0)
+        for _ in range(50):
+            if yubino.device.scrub_status(self.device) == 0:
+                break
+            time.sleep(0.1)
+        self.assertEqual(yubino.device.scrub_status(self.device), 0)
+
     def test_make_credentials(self):
         yubino.device.reset(self.device)
         (toto_id, toto_key) = yubino.device.make_credential(self.device, "toto")
@@ -52,6 +65,62 @@ class TestDevice(unittest.TestCase):
         self.assertEqual(entries[0]['hashed_app_id'], hashlib.sha1("toto".encode()).digest())
         self.assertEqual(entries[0]['credential_id'], second_id)
 
+    def test_add_credentials(self):
+        yubino.device.reset(self.device)
+        (alice_id, alice_key) = yubino.device.add_credential(self.device, "toto")
+        (bob_id, _) = yubino.device.add_credential(self.device, "toto")
+        entries = yubino.device.list_credentials(self.device)
+        self.assertEqual(len(entries), 2)
+        self.assertEqual({entry['credential_id'] for entry in entries}, {alice_id, bob_id})
+
+        challenge = secrets.token_hex(64)
+        unknown_id = bytes(yubino.device.CREDENTIAL_ID_SIZE)
+        (used_credential_id, signature, _) = yubino.device.get_assertion(
+                self.device, "toto", challenge, [unknown_id, alice_id, bob_id])
+        self.assertEqual(used_credential_id, alice_id)
+        ecdsa_public_key = ecdsa.VerifyingKey.from_string(
+                alice_key,
+                curve=ecdsa.SECP160r1)
+        fixed_sig = b'\x00' + signature[:20] + b'\x00' + signature[20:]
+        ecdsa_public_key.verify_digest(fixed_sig, yubino.device.get_client_data_hash(challenge, "toto"))
+
+        # credential ids are bound to their app_id
+        with self.assertRaises(Exception) as ex:
+            yubino.device.get_assertion(self.device, "tutu", challenge, [alice_id])
+        # 4 = STATUS_ERR_NOT_FOUND
+        self.assertEqual(ex.exception.args[0], "Device returned error code 4")
+
+    def test_list_credentials_page(self):
+        yubino.device.reset(self.device)
+        for app_id in ["toto", "tutu", "titi"]:
+            yubino.device.make_credential(self.device, app_id)
+        expected = yubino.device.list_credentials(self.device)
+
+        entries = []
+        cursor = 0
+        while cursor is not None:
+            (page, cursor) = yubino.device.list_credentials_page(self.device, cursor, 2)
+            self.assertLessEqual(len(page), 2)
+            entries += page
+        self.assertEqual(entries, expected)
+
+        toto_hash = hashlib.sha1("toto".encode()).digest()
+        (page, cursor) = yubino.device.list_credentials_page(self.device, 0, 8, toto_hash[:4])
+        self.assertEqual(len(page), 1)
+        self.assertEqual(page[0]['hashed_app_id'], toto_hash)
+        self.assertIsNone(cursor)
+
+        with self.assertRaises(Exception) as ex:
+            yubino.device.list_credentials_page(self.device, 0, 0)
+        # 3 = STATUS_ERR_BAD_PARAMETER
+        self.assertEqual(ex.exception.args[0], "Device returned error code 3")
+
+        # a too long prefix is refused, its bytes are not run as commands
+        prefix = bytes([yubino.device.COMMAND_RESET]) * (yubino.device.APP_ID_SIZE + 1)
+        self.device.write(struct.pack('BBBB', yubino.device.COMMAND_LIST_CREDENTIALS_PAGE, 0, 8, len(prefix)) + prefix)
+        self.assertEqual(struct.unpack('B', self.device.read())[0], 3)
+        self.assertEqual(yubino.device.list_credentials(self.device), expected)
+
     def test_make_credentials_full(self):
         yubino.device.reset(self.device)
         with self.assertRaises(Exception) as ex:
@@ -72,7 +141,7 @@ class TestDevice(unittest.TestCase):
         yubino.device.reset(self.device)
         (credential_id, public_key) = yubino.device.make_credential(self.device, "toto")
         challenge = secrets.token_hex(64)
-        (used_credential_id, signature) = yubino.device.get_assertion(self.device, "toto", challenge)
+        (used_credential_id, signature, _) = yubino.device.get_assertion(self.device, "toto", challenge)
 
         self.assertEqual(credential_id, used_credential_id)
         ecdsa_public_key = ecdsa.VerifyingKey.from_string(
@@ -81,13 +150,35 @@ class TestDevice(unittest.TestCase):
         fixed_sig = b'\x00' + signature[:20] + b'\x00' + signature[20:]
         ecdsa_public_key.verify_digest(fixed_sig, yubino.device.get_client_data_hash(challenge, "toto"))
 
+    def test_compressed_keys(self):
+        yubino.device.reset(self.device)
+        yubino.device.set_compressed_keys(self.device, True)
+        try:
+            (_, public_key) = yubino.device.make_credential(self.device, "toto")
+        finally:
+            yubino.device.set_compressed_keys(self.device, False)
+        self.assertEqual(len(public_key), yubino.device.COMPRESSED_PUBLIC_KEY_SIZE)
+        self.assertIn(public_key[0], (2, 3))
+
+        # the mode is read back from the device, not remembered by the client
+        yubino.device.set_option(self.device, yubino.device.OPTION_COMPRESSED_KEYS, 1)
+        try:
+            (_, public_key) = yubino.device.make_credential(self.device, "toto")
+        finally:
+            yubino.device.set_option(self.device, yubino.device.OPTION_COMPRESSED_KEYS, 0)
+        self.assertEqual(len(public_key), yubino.device.COMPRESSED_PUBLIC_KEY_SIZE)
+
+        challenge = secrets.token_hex(64)
+        (_, signature, _) = yubino.device.get_assertion(self.device, "toto", challenge)
+        yubino.device.verify_signature(public_key, signature, yubino.device.get_client_data_hash(challenge, "toto"))
+
     def test_get_assertion_multiple_creds(self):
         yubino.device.reset(self.device)
         (toto_credential_id, toto_public_key) = yubino.device.make_credential(self.device, "toto")
         (tutu_credential_id, tutu_public_key) = yubino.device.make_credential(self.device, "tutu")
 
         challenge = secrets.token_hex(64)
-        (used_credential_id, signature) = yubino.device.get_assertion(self.device, "toto", challenge)
+        (used_credential_id, signature, _) = yubino.device.get_assertion(self.device, "toto", challenge)
 
         self.assertEqual(toto_credential_id, used_credential_id)
         ecdsa_public_key = ecdsa.VerifyingKey.from_string(
@@ -96,6 +187,183 @@ class TestDevice(unittest.TestCase):
         fixed_sig = b'\x00' + signature[:20] + b'\x00' + signature[20:]
         ecdsa_public_key.verify_digest(fixed_sig, yubino.device.get_client_data_hash(challenge, "toto"))
 
+    def test_get_assertion_batch(self):
+        yubino.device.reset(self.device)
+        (toto_id, toto_key) = yubino.device.make_credential(self.device, "toto")
+        (tutu_id, tutu_key) = yubino.device.make_credential(self.device, "tutu")
+        requests = [("toto", secrets.token_hex(64)), ("titi", secrets.token_hex(64)), ("tutu", secrets.token_hex(64))]
+        results = yubino.device.get_assertion_batch(self.device, requests)
+
+        self.assertEqual(len(results), 3)
+        # 4 = STATUS_ERR_NOT_FOUND
+        self.assertEqual(results[1][0], 4)
+        for ((app_id, challenge), (status, credential_id, signature, _), expected_id, public_key) in zip(
+                [requests[0], requests[2]], [results[0], results[2]], [toto_id, tutu_id], [toto_key, tutu_key]):
+            self.assertEqual(status, 0)
+            self.assertEqual(credential_id, expected_id)
+            ecdsa_public_key = ecdsa.VerifyingKey.from_string(
+                    public_key,
+                    curve=ecdsa.SECP160r1)
+            fixed_sig = b'\x00' + signature[:20] + b'\x00' + signature[20:]
+            ecdsa_public_key.verify_digest(fixed_sig, yubino.device.get_client_data_hash(challenge, app_id))
+        self.assertGreater(results[2][3], results[0][3])
+
+    def test_get_assertion_counter(self):
+        yubino.device.reset(self.device)
+        yubino.device.make_credential(self.device, "toto")
+        (_, _, first) = yubino.device.get_assertion(self.device, "toto", secrets.token_hex(64))
+        (_, _, second) = yubino.device.get_assertion(self.device, "toto", secrets.token_hex(64))
+        self.assertGreater(second, first)
+
+    def test_get_wrapped_assertion(self):
+        (credential_id, public_key) = yubino.device.make_wrapped_credential(self.device, "toto")
+        challenge = secrets.token_hex(64)
+        (_, signature, _) = yubino.device.get_wrapped_assertion(self.device, "toto", challenge, credential_id)
+
+        ecdsa_public_key = ecdsa.VerifyingKey.from_string(
+                public_key,
+                curve=ecdsa.SECP160r1)
+        fixed_sig = b'\x00' + signature[:20] + b'\x00' + signature[20:]
+        ecdsa_public_key.verify_digest(fixed_sig, yubino.device.get_client_data_hash(challenge, "toto"))
+
+        # bound to the app_id it was made for
+        with self.assertRaises(Exception) as ex:
+            yubino.device.get_wrapped_assertion(self.device, "tutu", challenge, credential_id)
+        # 4 = STATUS_ERR_NOT_FOUND
+        self.assertEqual(ex.exception.args[0], "Device returned error code 4")
+
+    def test_set_baud(self):
+        yubino.device.reset(self.device)
+        (credential_id, _) = yubino.device.make_credential(self.device, "toto")
+        self.assertTrue(yubino.device.set_baud(self.device, 1000000))
+        entries = yubino.device.list_credentials(self.device)
+        self.assertEqual(len(entries), 1)
+        self.assertEqual(entries[0]['credential_id'], credential_id)
+        self.assertTrue(yubino.device.set_baud(self.device, BAUD_RATE))
+
+    def test_framed_pipeline(self):
+        framed = yubino.device.FramedDevice(self.device)
+        yubino.device.reset(framed)
+        (credential_id, _) = yubino.device.make_credential(framed, "toto")
+
+        # several requests in flight, answered by id
+        list_id = framed.send(struct.pack('B', yubino.device.COMMAND_LIST_CREDENTIALS))
+        bad_id = framed.send(struct.pack('B', 100))
+        scrub_id = framed.send(struct.pack('B', yubino.device.COMMAND_SCRUB_STATUS))
+        self.assertEqual(framed.receive(bad_id), struct.pack('B', 1))
+        self.assertEqual(framed.receive(scrub_id)[0], 0)
+        response = framed.receive(list_id)
+        self.assertEqual(response[:2], struct.pack('BB', 0, 1))
+        self.assertEqual(response[2:2 + yubino.device.CREDENTIAL_ID_SIZE], credential_id)
+
+        # a corrupted frame is rejected, and the link stays usable
+        self.device.write(bytes([yubino.device.FRAME_SYNC, 1, 42, yubino.device.COMMAND_LIST_CREDENTIALS, 0, 0]))
+        self.assertEqual(framed.receive(42), struct.pack('B', yubino.device.STATUS_ERR_BAD_FRAME))
+        self.assertEqual(len(yubino.device.list_credentials(framed)), 1)
+
+        # the rest of a frame with a bad LEN is dropped, never run as v1 commands
+        self.device.write(bytes([yubino.device.FRAME_SYNC, 255, 43]) + bytes([yubino.device.COMMAND_SCRUB_STATUS] * 8))
+        time.sleep(0.2)
+        self.assertEqual(self.device.in_waiting, 0)
+        self.assertEqual(len(yubino.device.list_credentials(framed)), 1)
+
+    def test_cancel_pending(self):
+        framed = yubino.device.FramedDevice(self.device)
+        yubino.device.reset(framed)
+        yubino.device.make_credential(framed, "toto")
+
+        # the assertion waits for the button while INFO and CANCEL are answered
+        app_id = hashlib.sha1("toto".encode()).digest()
+        client_data_hash = yubino.device.get_client_data_hash(secrets.token_hex(64), "toto")
+        assertion_id = framed.send(struct.pack('B', yubino.device.COMMAND_GET_ASSERTION) + app_id + client_data_hash)
+        time.sleep(0.5)
+        info = yubino.device.info(framed)
+        self.assertEqual(info['state'], yubino.device.INFO_STATE_CONSENT)
+        self.assertEqual(info['count'], 1)
+        yubino.device.cancel(framed)
+        self.assertEqual(framed.receive(assertion_id), struct.pack('B', yubino.device.STATUS_ERR_APPROVAL))
+
+        self.assertEqual(yubino.device.info(framed)['state'], yubino.device.INFO_STATE_IDLE)
+        with self.assertRaises(Exception) as ex:
+            yubino.device.cancel(framed)
+        # 4 = STATUS_ERR_NOT_FOUND
+        self.assertEqual(ex.exception.args[0], "Device returned error code 4")
+
+    @unittest.skipUnless(RTSCTS, "needs RTS/CTS wiring")
+    def test_flow_control(self):
+        framed = yubino.device.FramedDevice(self.device)
+        yubino.device.reset(framed)
+        yubino.device.make_credential(framed, "toto")
+
+        # far more than the 128 bytes RX buffer, sent in one go
+        prefix = hashlib.sha1("toto".encode()).digest()
+        request = struct.pack('BBBB', yubino.device.COMMAND_LIST_CREDENTIALS_PAGE, 0, 8, len(prefix)) + prefix
+        ids = [framed.send(request) for _ in range(32)]
+        for req_id in ids:
+            response = framed.receive(req_id)
+            self.assertEqual(response[:2], struct.pack('BB', 0, yubino.device.LIST_PAGE_ENTRY))
+
+    def test_trace(self):
+        yubino.device.reset(self.device)
+        yubino.device.get_trace(self.device)
+        yubino.device.make_credential(self.device, "toto")
+
+        events = yubino.device.get_trace(self.device)
+        names = [event for (event, _, _) in events]
+        for phase in ('received', 'args_complete', 'rng_done', 'crypto_done', 'consent', 'tx_done'):
+            self.assertIn(phase, names)
+        received = [arg for (event, arg, _) in events if event == 'received']
+        self.assertEqual(received, [yubino.device.COMMAND_MAKE_CREDENTIAL, yubino.device.COMMAND_GET_TRACE])
+        # timestamps only go forward within one command
+        times = [time_us for (_, _, time_us) in events]
+        self.assertEqual(times, sorted(times))
+
+    def test_stats(self):
+        before = yubino.device.get_stats(self.device)
+        yubino.device.make_credential(self.device, "toto")
+        self.device.write(struct.pack('B', 100))
+        self.assertEqual(struct.unpack('B', self.device.read())[0], yubino.device.STATUS_ERR_COMMAND_UNKNOWN)
+        after = yubino.device.get_stats(self.device)
+
+        def delta(table, key):
+            return after[table][key] - before[table][key]
+        self.assertEqual(delta('commands', yubino.device.COMMAND_MAKE_CREDENTIAL), 1)
+        self.assertEqual(delta('commands', yubino.device.COMMAND_GET_STATS), 1)
+        self.assertEqual(delta('commands', len(after['commands']) - 1), 1)
+        self.assertEqual(delta('statuses', yubino.device.STATUS_ERR_COMMAND_UNKNOWN), 1)
+        # INFO (key format), MAKE_CREDENTIAL and the first GET_STATS
+        self.assertEqual(delta('statuses', yubino.device.STATUS_OK), 3)
+        # the credential id at least: the key pair may have been computed in the
+        # background before the counters were first read
+        self.assertGreaterEqual(after['rng_bytes'] - before['rng_bytes'], yubino.device.CREDENTIAL_ID_SIZE)
+        self.assertGreater(after['storage_bytes'], before['storage_bytes'])
+
+    def test_presence_window(self):
+        yubino.device.reset(self.device)
+        yubino.device.make_credential(self.device, "toto")
+        yubino.device.set_presence_window(self.device, 10, 2)
+        # one press, then two assertions within the window
+        counters = [yubino.device.get_assertion(self.device, "toto", secrets.token_hex(64))[2] for _ in range(3)]
+        self.assertEqual(counters, sorted(counters))
+        yubino.device.set_presence_window(self.device, 0, 0)
+
+        # widening the window waits for the button, cancelled here
+        framed = yubino.device.FramedDevice(self.device)
+        option_id = framed.send(struct.pack('>BBH', yubino.device.COMMAND_SET_OPTION,
+                                            yubino.device.OPTION_PRESENCE_WINDOW, (10 << 8) | 2))
+        time.sleep(0.5)
+        self.assertEqual(yubino.device.info(framed)['state'], yubino.device.INFO_STATE_CONSENT)
+        yubino.device.cancel(framed)
+        self.assertEqual(framed.receive(option_id), struct.pack('B', yubino.device.STATUS_ERR_APPROVAL))
+
+        # 3 = STATUS_ERR_BAD_PARAMETER
+        for (option, value) in ((yubino.device.OPTION_PRESENCE_WINDOW, (255 << 8) | 1),
+                                (yubino.device.OPTION_PRESENCE_WINDOW, (10 << 8) | 255),
+                                (100, 0)):
+            with self.assertRaises(Exception) as ex:
+                yubino.device.set_option(framed, option, value)
+            self.assertEqual(ex.exception.args[0], "Device returned error code 3")
+
     def test_bad_command(self):
         self.device.write(struct.pack('B', 100))
         self.device.flush()
@@ -1,19 +1,77 @@
 import struct
 import hashlib
 import logging
+import time
+import functools
+import ecdsa
 
 COMMAND_LIST_CREDENTIALS = 0
 COMMAND_MAKE_CREDENTIAL = 1
 COMMAND_GET_ASSERTION = 2
 COMMAND_RESET = 3
+COMMAND_SCRUB_STATUS = 4
+COMMAND_MAKE_WRAPPED_CREDENTIAL = 5
+COMMAND_GET_WRAPPED_ASSERTION = 6
+COMMAND_GET_ASSERTION_ALLOW = 7
+COMMAND_ADD_CREDENTIAL = 8
+COMMAND_LIST_CREDENTIALS_PAGE = 9
+COMMAND_SET_BAUD = 10
+COMMAND_GET_ASSERTION_BATCH = 11
+COMMAND_SET_OPTION = 12
+COMMAND_CANCEL = 13
+COMMAND_INFO = 14
+COMMAND_GET_TRACE = 15
+COMMAND_GET_STATS = 16
+
+OPTION_PRESENCE_WINDOW = 1
+OPTION_COMPRESSED_KEYS = 2
+INFO_OPTION_COMPRESSED_KEYS = 1
+# default build-time caps of the presence window (PRESENCE_WINDOW_MAX_* in consts.h)
+PRESENCE_WINDOW_MAX_SECONDS = 120
+PRESENCE_WINDOW_MAX_USES = 10
 
 STATUS_OK = 0
 STATUS_ERR_COMMAND_UNKNOWN = 1
+STATUS_ERR_NOT_FOUND = 4
+STATUS_ERR_APPROVAL = 6
+STATUS_ERR_BAD_FRAME = 7
 
 CREDENTIAL_ID_SIZE = 16
+WRAPPED_CREDENTIAL_ID_SIZE = 49
 PUBLIC_KEY_SIZE = 40
+COMPRESSED_PUBLIC_KEY_SIZE = 21
 APP_ID_SIZE = 20
 SIGNATURE_SIZE = 40
+COUNTER_SIZE = 4
+ALLOW_LIST_MAX = 16
+GET_ASSERTION_BATCH_MAX = 3
+
+DEFAULT_BAUD = 115200
+# baud rate -> code sent with SET_BAUD
+BAUD_RATES = {115200: 0, 250000: 1, 500000: 2, 1000000: 3}
+BAUD_PROBE = 0x55
+BAUD_PROBE_TIMEOUT = 1.0
+
+FRAME_SYNC = 0xA5
+FRAME_MAX_PAYLOAD = 128
+FRAME_FLAG_MORE = 0x01
+
+TRACE_EVENTS = {
+    1: 'received',
+    2: 'args_complete',
+    3: 'rng_done',
+    4: 'crypto_done',
+    5: 'consent',
+    6: 'eeprom_done',
+    7: 'tx_done',
+}
+
+INFO_STATE_IDLE = 0
+INFO_STATE_CONSENT = 1
+
+LIST_PAGE_ENTRY = 1
+LIST_PAGE_END = 0
+CURSOR_END = 0xFF
 
 def reset(device):
     """
@@ -34,6 +92,259 @@ def reset(device):
 
     return True
 
+def set_baud(device, baud):
+    """
+    Send a SET_BAUD command to the device and switch <device> to <baud>
+
+    The device answers at the current rate, switches, and waits for a probe
+    byte at the new rate that it echoes back. If the probe fails both sides
+    go back to the current rate.
+
+    :except Exception: if the device returns an error
+    :except ValueError: if <baud> is not supported by the device
+
+    :return True if the link now runs at <baud>, False if it stayed at the current rate
+    """
+    if baud not in BAUD_RATES:
+        raise ValueError(f"Unsupported baud rate {baud}, choose among {sorted(BAUD_RATES)}")
+
+    logging.info("Sending SET_BAUD command with baud=%d", baud)
+    device.write(struct.pack('BB', COMMAND_SET_BAUD, BAUD_RATES[baud]))
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    # the probe is never framed
+    link = device.serial if isinstance(device, FramedDevice) else device
+    old_baud = link.baudrate
+    old_timeout = link.timeout
+    link.baudrate = baud
+    link.reset_input_buffer()
+    link.timeout = BAUD_PROBE_TIMEOUT
+    link.write(struct.pack('B', BAUD_PROBE))
+    link.flush()
+    echo = link.read(1)
+    link.timeout = old_timeout
+
+    if echo == struct.pack('B', BAUD_PROBE):
+        logging.debug("Link now running at %d bauds", baud)
+        return True
+
+    logging.warning("Probe failed at %d bauds, falling back to %d", baud, old_baud)
+    # the device goes back to the old rate once its probe timeout expires
+    time.sleep(BAUD_PROBE_TIMEOUT)
+    link.baudrate = old_baud
+    link.reset_input_buffer()
+    return False
+
+def set_option(device, option, value):
+    """
+    Send a SET_OPTION command to the device
+
+    Options are kept in RAM and are lost when the device restarts.
+
+    :param <option>: one of the OPTION_* constants
+    :param <value>: 16 bits value, meaning depends on <option>
+
+    :except Exception: if the device returns an error (3 for an unknown option)
+    """
+    logging.info("Sending SET_OPTION command with option=%d and value=%d", option, value)
+    device.write(struct.pack('>BBH', COMMAND_SET_OPTION, option, value))
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+def set_presence_window(device, seconds, max_uses):
+    """
+    Configure the presence window of the device
+
+    After a button press for an assertion, up to <max_uses> further assertions
+    for the same app_id within <seconds> seconds need no new press. The LED
+    stays dimly lit while the window is open. A RESET closes it.
+    <seconds> = 0 disables the window.
+
+    A longer window or more uses than the current setting must be confirmed
+    with the button, like RESET. The device rejects values above its build-time
+    caps with error code 3.
+    """
+    if not 0 <= seconds <= 255 or not 0 <= max_uses <= 255:
+        raise ValueError("seconds and max_uses must fit in a byte")
+    set_option(device, OPTION_PRESENCE_WINDOW, (seconds << 8) | max_uses)
+
+def set_compressed_keys(device, enabled):
+    """
+    Ask the device to return compressed public keys (21 bytes instead of 40)
+
+    Like every option, the mode is lost when the device restarts: make_credential
+    and friends read it back with INFO before each request.
+    """
+    set_option(device, OPTION_COMPRESSED_KEYS, 1 if enabled else 0)
+
+def _public_key_size(device):
+    compressed = info(device)['options'] & INFO_OPTION_COMPRESSED_KEYS
+    return COMPRESSED_PUBLIC_KEY_SIZE if compressed else PUBLIC_KEY_SIZE
+
+@functools.lru_cache(maxsize=256)
+def verifying_key(public_key):
+    """
+    ecdsa verifying key of a public key returned by the device, compressed or not
+
+    Decompressing a key costs a modular square root: keys are cached so that
+    repeated logins with the same credential only pay it once.
+    """
+    return ecdsa.VerifyingKey.from_string(public_key, curve=ecdsa.SECP160r1)
+
+def verify_signature(public_key, signature, client_data_hash):
+    """
+    Check a signature returned by get_assertion against <public_key>
+
+    :except ecdsa.BadSignatureError: if the signature does not match
+    """
+    # r and s are 160 bits on the wire, the curve order is 161 bits
+    fixed_sig = b'\x00' + signature[:20] + b'\x00' + signature[20:]
+    return verifying_key(bytes(public_key)).verify_digest(fixed_sig, client_data_hash)
+
+def scrub_status(device):
+    """
+    Send a SCRUB_STATUS command to the device
+
+    After a RESET, old credentials are hidden at once and their private keys
+    are erased in the background.
+
+    :except Exception: if the device returns an error
+
+    :return the number of storage slots still waiting to be erased
+    """
+    logging.info("Sending SCRUB_STATUS command")
+    device.write(struct.pack('B', COMMAND_SCRUB_STATUS))
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    remaining = struct.unpack('B', device.read())[0]
+    logging.debug("%d slots left to scrub", remaining)
+    return remaining
+
+def info(device):
+    """
+    Send an INFO command to the device
+
+    INFO is answered even while another request waits for the button.
+
+    :except Exception: if the device returns an error
+
+    :return a dict with the protocol version, the state (INFO_STATE_IDLE or
+    INFO_STATE_CONSENT), the number of credentials, the storage capacity and
+    the options in effect (INFO_OPTION_* flags)
+    """
+    logging.info("Sending INFO command")
+    device.write(struct.pack('B', COMMAND_INFO))
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    (version, state, count, capacity, options) = struct.unpack('BBBBB', device.read(5))
+    return {'version': version, 'state': state, 'count': count, 'capacity': capacity, 'options': options}
+
+def get_trace(device):
+    """
+    Send a GET_TRACE command to the device
+
+    The device keeps its last command phases in a small ring (16 events),
+    timestamped by a microsecond clock that wraps every 71 minutes. Events are
+    removed once sent, so each call returns what happened since the previous one.
+
+    :except Exception: if the device returns an error
+
+    :return a list of (<event: str>, <arg: int>, <time_us: int>), oldest first,
+    where <event> is a value of TRACE_EVENTS and <arg> the opcode for
+    'received', the status for 'crypto_done' and the consent state for 'consent'
+    """
+    logging.info("Sending GET_TRACE command")
+    device.write(struct.pack('B', COMMAND_GET_TRACE))
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    count = struct.unpack('B', device.read())[0]
+    events = []
+    for _ in range(count):
+        (event, arg, time_us) = struct.unpack('>BBI', device.read(6))
+        events.append((TRACE_EVENTS.get(event, str(event)), arg, time_us))
+    return events
+
+def get_stats(device):
+    """
+    Send a GET_STATS command to the device
+
+    The counters live in RAM: they start from 0 at power on and saturate
+    instead of wrapping around.
+
+    :except Exception: if the device returns an error
+
+    :return a dict with 'commands' (opcode -> count, the last entry counting
+    unknown opcodes), 'statuses' (status -> count of responses), and the
+    'rx_overflows', 'rx_timeouts', 'consent_timeouts', 'uecc_retries',
+    'storage_bytes' and 'rng_bytes' counters
+    """
+    logging.info("Sending GET_STATS command")
+    device.write(struct.pack('B', COMMAND_GET_STATS))
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    stats = {}
+    for table in ('commands', 'statuses'):
+        count = struct.unpack('B', device.read())[0]
+        stats[table] = dict(enumerate(struct.unpack(f'>{count}H', device.read(2 * count))))
+    (stats['rx_overflows'], stats['rx_timeouts'], stats['consent_timeouts'], stats['uecc_retries'],
+     stats['storage_bytes'], stats['rng_bytes']) = struct.unpack('>HHHHII', device.read(16))
+    return stats
+
+def cancel(device):
+    """
+    Send a CANCEL command to the device
+
+    The request waiting for the button is answered with STATUS_ERR_APPROVAL
+    before the response to CANCEL. Only useful with a FramedDevice, where
+    the pending request and CANCEL can be in flight at the same time.
+
+    :except Exception: if nothing was waiting for the button
+    """
+    logging.info("Sending CANCEL command")
+    device.write(struct.pack('B', COMMAND_CANCEL))
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
 def make_credential(device, app_id):
     """
     Send a MAKE_CREDENTIAL command to the device
@@ -45,11 +356,32 @@ def make_credential(device, app_id):
 
     :return (<credential_id: bytes>, <public_key: bytes>), where
     - <credential_id> is the generated keypair identifier returned by the device
-    - <public_key> is the publkic part of the generated key pair
+    - <public_key> is the publkic part of the generated key pair, compressed
+      (21 bytes) if the device has OPTION_COMPRESSED_KEYS set, x | y (40 bytes) otherwise
+
+    A credential previously made for <app_id> with make_credential or
+    add_credential is replaced.
     """
+    return _make_credential(device, app_id, COMMAND_MAKE_CREDENTIAL, "MAKE_CREDENTIAL")
+
+def add_credential(device, app_id):
+    """
+    Send an ADD_CREDENTIAL command to the device
+
+    Same as make_credential, but the credentials already stored for <app_id>
+    are kept: several accounts can share one relying party.
+
+    :except Exception: if the device returns an error.
+
+    :return (<credential_id: bytes>, <public_key: bytes>)
+    """
+    return _make_credential(device, app_id, COMMAND_ADD_CREDENTIAL, "ADD_CREDENTIAL")
+
+def _make_credential(device, app_id, command, name):
     hashed_app_id = hashlib.sha1(app_id.encode()).digest()
-    logging.info("Sending MAKE_CREDENTIAL command with hashed_app_id=%s", hashed_app_id.hex())
-    device.write(struct.pack('B', COMMAND_MAKE_CREDENTIAL))
+    public_key_size = _public_key_size(device)
+    logging.info("Sending %s command with hashed_app_id=%s", name, hashed_app_id.hex())
+    device.write(struct.pack('B', command))
     device.write(hashed_app_id)
     device.flush()
 
@@ -64,7 +396,7 @@ def make_credential(device, app_id):
     logging.debug("credential_id = %s", credential_id.hex())
 
     logging.debug("Retrieve public_key")
-    public_key = device.read(PUBLIC_KEY_SIZE)
+    public_key = device.read(public_key_size)
     logging.debug("public_key = %s", public_key.hex())
 
     return (credential_id, public_key)
@@ -105,22 +437,64 @@ def list_credentials(device):
         entries.append({'hashed_app_id': app_id, 'credential_id': credential_id})
     return entries
 
+def list_credentials_page(device, cursor=0, page_size=8, prefix=b''):
+    """
+    Send a LIST_CREDENTIALS_PAGE command to the device
+
+    :param <cursor>: 0 for the first page, then the cursor returned by the previous call
+    :param <page_size>: maximum number of entries returned, at least 1
+    :param <prefix>: only list the credentials whose hashed_app_id starts with these bytes
+
+    :except Exception: if the device returns an error
+
+    :return (<entries>, <cursor>), where <entries> is formatted as in
+    list_credentials and <cursor> is None when there is no more page
+    """
+    if len(prefix) > APP_ID_SIZE:
+        raise ValueError(f"Prefix must be at most {APP_ID_SIZE} bytes long")
+    logging.info("Sending LIST_CREDENTIALS_PAGE command with cursor=%d, page_size=%d and prefix=%s",
+                 cursor, page_size, prefix.hex())
+    device.write(struct.pack('BBBB', COMMAND_LIST_CREDENTIALS_PAGE, cursor, page_size, len(prefix)))
+    device.write(prefix)
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    entries = []
+    while struct.unpack('B', device.read())[0] == LIST_PAGE_ENTRY:
+        credential_id = device.read(CREDENTIAL_ID_SIZE)
+        app_id = device.read(APP_ID_SIZE)
+        logging.debug("credential_id = %s, hashed_app_id = %s", credential_id.hex(), app_id.hex())
+        entries.append({'hashed_app_id': app_id, 'credential_id': credential_id})
+
+    cursor = struct.unpack('B', device.read())[0]
+    logging.debug("next cursor = %d", cursor)
+    return (entries, None if cursor == CURSOR_END else cursor)
+
 
 def get_client_data_hash(challenge, app_id):
     return hashlib.sha1(("challenge=%s&app_id=%s" % (challenge, app_id)).encode()).digest()
 
-def get_assertion(device, app_id, challenge):
+def get_assertion(device, app_id, challenge, allow_list=None):
     """
     Send a GET_ASSERTION command to the device
 
     :param <app_id>: raw app_id given by the Relying Party
     :param <challenge>: raw challenge sent by the Relying Party. Must be a valid hexadecimal string.
+    :param <allow_list>: optional list of credential ids (bytes). If given,
+    GET_ASSERTION_ALLOW is sent and the device signs with the first one it holds
+    for <app_id>; otherwise the most recent credential of <app_id> is used.
 
     :except Exception: if the device returns an error
 
-    :return (<credential_id: bytes>, <signature: bytes>) where
+    :return (<credential_id: bytes>, <signature: bytes>, <counter: int>) where
     - <credential_id> is the identifier of the key pair used to compute the signature
     - <signature> is the signature of clientDataHash
+    - <counter> is the device signature counter, increased by every assertion
     """
     hashed_app_id = hashlib.sha1(app_id.encode()).digest()
     logging.info("Sending GET_ASSERTION command with hashed_app_id=%s and challenge=%s",
@@ -131,11 +505,24 @@ def get_assertion(device, app_id, challenge):
         logging.error("Failed to convert challenge to bytes: %s", e)
         raise
 
+    if allow_list is not None:
+        if len(allow_list) > ALLOW_LIST_MAX:
+            raise ValueError(f"At most {ALLOW_LIST_MAX} credential ids can be allowed")
+        if any(len(c) != CREDENTIAL_ID_SIZE for c in allow_list):
+            raise ValueError(f"Credential ids must be {CREDENTIAL_ID_SIZE} bytes long")
+
     client_data_hash = get_client_data_hash(challenge, app_id)
     logging.debug("client_data_hash = %s", client_data_hash.hex())
-    device.write(struct.pack('B', COMMAND_GET_ASSERTION))
+    if allow_list is None:
+        device.write(struct.pack('B', COMMAND_GET_ASSERTION))
+    else:
+        device.write(struct.pack('B', COMMAND_GET_ASSERTION_ALLOW))
     device.write(hashed_app_id)
     device.write(client_data_hash)
+    if allow_list is not None:
+        device.write(struct.pack('B', len(allow_list)))
+        for credential_id in allow_list:
+            device.write(credential_id)
     device.flush()
 
     status = struct.unpack('B', device.read())[0]
@@ -152,4 +539,252 @@ def get_assertion(device, app_id, challenge):
     signature = device.read(SIGNATURE_SIZE)
     logging.debug("signature = %s", signature.hex())
 
-    return (credential_id, signature)
+    counter = struct.unpack('>I', device.read(COUNTER_SIZE))[0]
+    logging.debug("counter = %d", counter)
+
+    return (credential_id, signature, counter)
+
+def get_assertion_batch(device, requests):
+    """
+    Send a GET_ASSERTION_BATCH command to the device
+
+    The user is asked for consent once for all the assertions.
+
+    :param <requests>: list of (<app_id>, <challenge>) pairs, as in get_assertion
+    (at most GET_ASSERTION_BATCH_MAX)
+
+    :except Exception: if the device returns an error for the whole batch
+
+    :return a list with, for each request, (<status: int>, <credential_id: bytes>,
+    <signature: bytes>, <counter: int>). <credential_id>, <signature> and
+    <counter> are None when <status> is not STATUS_OK.
+    """
+    if not 0 < len(requests) <= GET_ASSERTION_BATCH_MAX:
+        raise ValueError(f"A batch holds 1 to {GET_ASSERTION_BATCH_MAX} requests")
+
+    logging.info("Sending GET_ASSERTION_BATCH command with %d requests", len(requests))
+    device.write(struct.pack('BB', COMMAND_GET_ASSERTION_BATCH, len(requests)))
+    for (app_id, challenge) in requests:
+        hashed_app_id = hashlib.sha1(app_id.encode()).digest()
+        client_data_hash = get_client_data_hash(challenge, app_id)
+        logging.debug("hashed_app_id = %s, client_data_hash = %s", hashed_app_id.hex(), client_data_hash.hex())
+        device.write(hashed_app_id)
+        device.write(client_data_hash)
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happenned: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    count = struct.unpack('B', device.read())[0]
+    results = []
+    for i in range(count):
+        status = struct.unpack('B', device.read())[0]
+        logging.debug("Assertion %d: status code %d", i, status)
+        if status != STATUS_OK:
+            results.append((status, None, None, None))
+            continue
+        credential_id = device.read(CREDENTIAL_ID_SIZE)
+        signature = device.read(SIGNATURE_SIZE)
+        counter = struct.unpack('>I', device.read(COUNTER_SIZE))[0]
+        logging.debug("credential_id = %s, signature = %s, counter = %d", credential_id.hex(), signature.hex(), counter)
+        results.append((status, credential_id, signature, counter))
+    return results
+
+def make_wrapped_credential(device, app_id):
+    """
+    Send a MAKE_WRAPPED_CREDENTIAL command to the device
+
+    Nothing is stored on the device: the returned credential_id contains the
+    private key encrypted under a device key, bound to <app_id>.
+
+    :except Exception: if the device returns an error.
+
+    :return (<credential_id: bytes>, <public_key: bytes>)
+    """
+    hashed_app_id = hashlib.sha1(app_id.encode()).digest()
+    public_key_size = _public_key_size(device)
+    logging.info("Sending MAKE_WRAPPED_CREDENTIAL command with hashed_app_id=%s", hashed_app_id.hex())
+    device.write(struct.pack('B', COMMAND_MAKE_WRAPPED_CREDENTIAL))
+    device.write(hashed_app_id)
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happened: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    logging.debug("Retrieve credential_id")
+    credential_id = device.read(WRAPPED_CREDENTIAL_ID_SIZE)
+    logging.debug("credential_id = %s", credential_id.hex())
+
+    logging.debug("Retrieve public_key")
+    public_key = device.read(public_key_size)
+    logging.debug("public_key = %s", public_key.hex())
+
+    return (credential_id, public_key)
+
+def get_wrapped_assertion(device, app_id, challenge, credential_id):
+    """
+    Send a GET_WRAPPED_ASSERTION command to the device
+
+    :param <app_id>: raw app_id given by the Relying Party
+    :param <challenge>: raw challenge sent by the Relying Party. Must be a valid hexadecimal string.
+    :param <credential_id>: credential id returned by make_wrapped_credential
+
+    :except Exception: if the device returns an error
+
+    :return (<credential_id: bytes>, <signature: bytes>, <counter: int>)
+    """
+    hashed_app_id = hashlib.sha1(app_id.encode()).digest()
+    logging.info("Sending GET_WRAPPED_ASSERTION command with hashed_app_id=%s and challenge=%s",
+                 hashed_app_id.hex(), challenge)
+    if len(credential_id) != WRAPPED_CREDENTIAL_ID_SIZE:
+        raise ValueError(f"Wrapped credential id must be {WRAPPED_CREDENTIAL_ID_SIZE} bytes long")
+
+    client_data_hash = get_client_data_hash(challenge, app_id)
+    logging.debug("client_data_hash = %s", client_data_hash.hex())
+    device.write(struct.pack('B', COMMAND_GET_WRAPPED_ASSERTION))
+    device.write(hashed_app_id)
+    device.write(client_data_hash)
+    device.write(credential_id)
+    device.flush()
+
+    status = struct.unpack('B', device.read())[0]
+    logging.debug("Received status code %d", status)
+    if status != STATUS_OK:
+        logging.error("Something bad happenned: error code %d", status)
+        raise Exception(f"Device returned error code {status}")
+
+    logging.debug("Retrieve signature")
+    signature = device.read(SIGNATURE_SIZE)
+    logging.debug("signature = %s", signature.hex())
+
+    counter = struct.unpack('>I', device.read(COUNTER_SIZE))[0]
+    logging.debug("counter = %d", counter)
+
+    return (credential_id, signature, counter)
+
+
+def crc_ccitt_update(crc, data):
+    """
+    Same as avr-libc's _crc_ccitt_update
+    """
+    data ^= crc & 0xFF
+    data ^= (data << 4) & 0xFF
+    return (((data << 8) | (crc >> 8)) ^ (data >> 4) ^ (data << 3)) & 0xFFFF
+
+def frame_crc(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc = crc_ccitt_update(crc, byte)
+    return crc
+
+class FramedDevice:
+    """
+    Protocol v2 on top of a serial device
+
+    Requests are sent as SYNC | LEN | REQ_ID | payload | CRC16 frames, and
+    responses come back as one or more SYNC | LEN | REQ_ID | FLAGS | payload | CRC16
+    frames. A corrupted or truncated frame is dropped by the device without
+    desynchronizing the link.
+
+    Requests can be queued back to back with send() and their responses
+    collected with receive(), in any order. The write/flush/read methods make
+    the functions of this module usable as they are, e.g.
+    list_credentials(FramedDevice(serial)).
+    """
+
+    def __init__(self, serial, timeout=15):
+        self.serial = serial
+        self.timeout = timeout
+        self.next_id = 0
+        self.responses = {}
+        self.partial = {}
+        self.request = b''
+        self.current = None
+        self.reply = b''
+
+    @property
+    def baudrate(self):
+        """
+        Rate of the underlying serial link (set_baud changes it)
+        """
+        return self.serial.baudrate
+
+    def send(self, payload):
+        """
+        Send a request frame whose payload is an opcode followed by its arguments
+
+        :return the request id to give to receive()
+        """
+        if not 0 < len(payload) <= FRAME_MAX_PAYLOAD:
+            raise ValueError(f"Frame payload must be 1 to {FRAME_MAX_PAYLOAD} bytes long")
+        req_id = self.next_id
+        self.next_id = (self.next_id + 1) % 256
+        head = struct.pack('BB', len(payload), req_id)
+        logging.debug("Sending frame %d: %s", req_id, payload.hex())
+        self.serial.write(struct.pack('B', FRAME_SYNC) + head + payload + struct.pack('>H', frame_crc(head + payload)))
+        self.serial.flush()
+        return req_id
+
+    def receive(self, req_id):
+        """
+        Wait for the response to request <req_id>, keeping the responses to
+        other requests for later
+
+        :except TimeoutError: if the device stops answering
+
+        :return the response payload, starting with the status code
+        """
+        while req_id not in self.responses:
+            self._read_frame()
+        return self.responses.pop(req_id)
+
+    def _read_exact(self, size):
+        data = self.serial.read(size)
+        if len(data) != size:
+            raise TimeoutError("No response from device")
+        return data
+
+    def _read_frame(self):
+        old_timeout = self.serial.timeout
+        self.serial.timeout = self.timeout
+        try:
+            # anything before a SYNC byte is a leftover of a broken frame
+            while self._read_exact(1)[0] != FRAME_SYNC:
+                pass
+            head = self._read_exact(3)
+            (length, req_id, flags) = struct.unpack('BBB', head)
+            payload = self._read_exact(length)
+            crc = struct.unpack('>H', self._read_exact(2))[0]
+        finally:
+            self.serial.timeout = old_timeout
+
+        if crc != frame_crc(head + payload):
+            logging.warning("Dropping response frame with a bad CRC")
+            return
+        logging.debug("Received frame %d: %s", req_id, payload.hex())
+        self.partial[req_id] = self.partial.get(req_id, b'') + payload
+        if not flags & FRAME_FLAG_MORE:
+            self.responses[req_id] = self.partial.pop(req_id)
+
+    def write(self, data):
+        self.request += data
+
+    def flush(self):
+        self.current = self.send(self.request)
+        self.request = b''
+        self.reply = b''
+
+    def read(self, size=1):
+        if self.current is not None:
+            self.reply += self.receive(self.current)
+            self.current = None
+        (data, self.reply) = (self.reply[:size], self.reply[size:])
+        if len(data) != size:
+            raise Exception("Device response is too short")
+        return data
@@ -6,10 +6,17 @@ def main() -> int:
     parser = argparse.ArgumentParser()
     parser.add_argument("-d", "--device", type=str, default="/dev/ttyACM0",
                         help="Connect to the given device, defaults to '/dev/ttyACM0'")
-    parser.add_argument("-b", "--baud", help="Baud rate, defaults to 115200",
+    parser.add_argument("-b", "--baud", help="Baud rate negotiated with the device "
+                        "(115200, 250000, 500000 or 1000000), defaults to 115200",
                         type=int, default=115200)
     parser.add_argument("-r", "--relying-party", default="http://localhost:8000", type=str,
                         help="Relying party to connect to, defaults to 'http://localhost:8000'")
+    parser.add_argument("-f", "--framed", help="Use the framed protocol (v2) with the device",
+                        action="store_true")
+    parser.add_argument("-c", "--compressed-keys", help="Ask the device for compressed (21 bytes) public keys",
+                        action="store_true")
+    parser.add_argument("--rtscts", help="Use RTS/CTS flow control (device RTS on PD4 wired to the "
+                        "adapter CTS)", action="store_true")
     parser.add_argument("--list-devices", help="List available serial devices", action="store_true")
     parser.add_argument("-v", "--verbose", help="Verbose mode", action="store_true")
     args = parser.parse_args()
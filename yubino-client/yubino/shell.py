@@ -4,6 +4,7 @@ import serial.tools.list_ports
 import cmd
 import shlex
 import secrets
+import time
 
 import yubino.device
 import yubino.web
@@ -18,7 +19,24 @@ class YubinoShell(cmd.Cmd):
 
     def preloop(self):
         logging.info("Connect to device %s", self.config.device)
-        self.device = serial.Serial(port=self.config.device, baudrate=self.config.baud, exclusive=True)
+        # le device demarre toujours au debit par defaut, un autre debit est negocie
+        self.device = serial.Serial(port=self.config.device, baudrate=yubino.device.DEFAULT_BAUD,
+                                    rtscts=self.config.rtscts, exclusive=True)
+        if self.config.baud != yubino.device.DEFAULT_BAUD:
+            # give the mcu some time to restart
+            time.sleep(2)
+            try:
+                if not yubino.device.set_baud(self.device, self.config.baud):
+                    logging.warning("Staying at %d bauds", yubino.device.DEFAULT_BAUD)
+            except Exception as e:
+                logging.error("Failed to set baud rate: %s", e)
+        if self.config.framed:
+            self.device = yubino.device.FramedDevice(self.device)
+        if self.config.compressed_keys:
+            try:
+                yubino.device.set_compressed_keys(self.device, True)
+            except Exception as e:
+                logging.error("Failed to enable compressed keys: %s", e)
         self.http_client = yubino.web.Client(self.config, self.device)
 
     def do_index(self, arg):
@@ -66,6 +84,94 @@ class YubinoShell(cmd.Cmd):
         'Reset the device'
         yubino.device.reset(self.device)
 
+    def do_device_set_baud(self, arg):
+        """
+        Switch the link with the device to <baud> (115200, 250000, 500000 or 1000000)
+        device_set_baud <baud>
+        """
+        try:
+            if yubino.device.set_baud(self.device, int(arg)):
+                print("Link running at %d bauds" % self.device.baudrate)
+            else:
+                print("Probe failed, link still running at %d bauds" % self.device.baudrate)
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+    def do_device_set_presence_window(self, arg):
+        """
+        After a button press, let up to <max_uses> assertions for the same app_id
+        go through without a new press for <seconds> seconds (0 to disable).
+        device_set_presence_window <seconds> <max_uses>
+        """
+        args = shlex.split(arg)
+        if len(args) != 2:
+            print("Usage: device_set_presence_window <seconds> <max_uses>")
+            return
+
+        try:
+            yubino.device.set_presence_window(self.device, int(args[0]), int(args[1]))
+            print("done")
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+    def do_device_scrub_status(self, arg):
+        """
+        Show how many storage slots still hold key material from before the last reset
+        """
+        try:
+            print("Slots left to scrub: %d" % yubino.device.scrub_status(self.device))
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+    def do_device_info(self, arg):
+        """
+        Show the protocol version, whether a request waits for the button, and the storage usage
+        """
+        try:
+            info = yubino.device.info(self.device)
+            state = "waiting for consent" if info['state'] == yubino.device.INFO_STATE_CONSENT else "idle"
+            print("Protocol version: %d" % info['version'])
+            print("State: %s" % state)
+            print("Credentials: %d/%d" % (info['count'], info['capacity']))
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+    def do_device_trace(self, arg):
+        """
+        Show the command phases recorded by the device since the last call, with their latency
+        """
+        try:
+            events = yubino.device.get_trace(self.device)
+        except Exception as e:
+            print("Operation failed: %s" % e)
+            return
+        previous = None
+        for (event, event_arg, time_us) in events:
+            # the clock wraps around every 2**32 us
+            delta = 0 if previous is None else (time_us - previous) % (1 << 32)
+            previous = time_us
+            print("%10d us  +%8d us  %-14s %d" % (time_us, delta, event, event_arg))
+
+    def do_device_stats(self, arg):
+        """
+        Show the device counters: commands per opcode, statuses returned, lost bytes,
+        timeouts, bytes written to storage and random bytes generated
+        """
+        try:
+            stats = yubino.device.get_stats(self.device)
+        except Exception as e:
+            print("Operation failed: %s" % e)
+            return
+        for (opcode, count) in stats['commands'].items():
+            if count:
+                name = "unknown" if opcode == len(stats['commands']) - 1 else "0x%02x" % opcode
+                print("%-16s %8d" % ("command " + name, count))
+        for (status, count) in stats['statuses'].items():
+            if count:
+                print("%-16s %8d" % ("status %d" % status, count))
+        for counter in ('rx_overflows', 'rx_timeouts', 'consent_timeouts', 'uecc_retries', 'storage_bytes', 'rng_bytes'):
+            print("%-16s %8d" % (counter, stats[counter]))
+
     def do_device_make_credential(self, arg):
         """
         Ask the device to generate a new keys for <app_id> pair
@@ -83,6 +189,23 @@ class YubinoShell(cmd.Cmd):
         except Exception as e:
             print("Operation failed: %s" % e)
 
+    def do_device_add_credential(self, arg):
+        """
+        Ask the device to generate one more key pair for <app_id>, keeping the existing ones,
+        and retrieve (credential_id, public_key).
+        device_add_credential <app_id>
+        """
+        if not arg:
+            print("Usage: device_add_credential <app_id>")
+            return
+
+        try:
+            (credential_id, public_key) = yubino.device.add_credential(self.device, arg)
+            print("Credential id: %s" %  credential_id.hex())
+            print("Public key: %s" % public_key.hex())
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
     def do_device_get_assertion(self, arg):
         """
         Ask the device to make an assertion on <challenge> for <app_id>.
@@ -98,8 +221,91 @@ class YubinoShell(cmd.Cmd):
         challenge = args[1] if len(args) == 2 else secrets.token_hex(32)
 
         try:
-            (credential_id, signature) = yubino.device.get_assertion(self.device, app_id, challenge)
-            print("credential_id: %s - signature: %s" % (credential_id.hex(), signature.hex()))
+            (credential_id, signature, counter) = yubino.device.get_assertion(self.device, app_id, challenge)
+            print("credential_id: %s - signature: %s - counter: %d" % (credential_id.hex(), signature.hex(), counter))
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+    def do_device_get_assertion_allow(self, arg):
+        """
+        Ask the device to make an assertion on <challenge> for <app_id> with one of the
+        comma separated <credential_ids>.
+        If <challenge> is not specified, it will be generated (32 bytes random).
+        device_get_assertion_allow <app_id> <credential_ids> <challenge>
+        """
+        args = shlex.split(arg)
+        if len(args) > 3 or len(args) < 2:
+            print("Usage: device_get_assertion_allow <app_id> <credential_ids> <challenge>")
+            return
+
+        app_id = args[0]
+        challenge = args[2] if len(args) == 3 else secrets.token_hex(32)
+
+        try:
+            allow_list = [bytes.fromhex(c) for c in args[1].split(',')]
+            (credential_id, signature, counter) = yubino.device.get_assertion(self.device, app_id, challenge, allow_list)
+            print("credential_id: %s - signature: %s - counter: %d" % (credential_id.hex(), signature.hex(), counter))
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+
+    def do_device_get_assertion_batch(self, arg):
+        """
+        Ask the device, with a single consent, to make an assertion for each <app_id>
+        on a generated challenge (32 bytes random).
+        device_get_assertion_batch <app_id> [<app_id> ...]
+        """
+        app_ids = shlex.split(arg)
+        if len(app_ids) == 0:
+            print("Usage: device_get_assertion_batch <app_id> [<app_id> ...]")
+            return
+
+        try:
+            requests = [(app_id, secrets.token_hex(32)) for app_id in app_ids]
+            results = yubino.device.get_assertion_batch(self.device, requests)
+            for (app_id, (status, credential_id, signature, counter)) in zip(app_ids, results):
+                if status != yubino.device.STATUS_OK:
+                    print("%s: error code %d" % (app_id, status))
+                else:
+                    print("%s: credential_id: %s - signature: %s - counter: %d" % (app_id, credential_id.hex(), signature.hex(), counter))
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+    def do_device_make_wrapped_credential(self, arg):
+        """
+        Ask the device to generate a new key pair for <app_id> without storing it.
+        The private key is returned encrypted inside the credential id.
+        device_make_wrapped_credential <app_id>
+        """
+        if not arg:
+            print("Usage: device_make_wrapped_credential <app_id>")
+            return
+
+        try:
+            (credential_id, public_key) = yubino.device.make_wrapped_credential(self.device, arg)
+            print("Credential id: %s" %  credential_id.hex())
+            print("Public key: %s" % public_key.hex())
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
+    def do_device_get_wrapped_assertion(self, arg):
+        """
+        Ask the device to make an assertion on <challenge> for <app_id> with a wrapped <credential_id>.
+        If <challenge> is not specified, it will be generated (32 bytes random).
+        device_get_wrapped_assertion <app_id> <credential_id> <challenge>
+        """
+        args = shlex.split(arg)
+        if len(args) > 3 or len(args) < 2:
+            print("Usage: device_get_wrapped_assertion <app_id> <credential_id> <challenge>")
+            return
+
+        app_id = args[0]
+        challenge = args[2] if len(args) == 3 else secrets.token_hex(32)
+
+        try:
+            credential_id = bytes.fromhex(args[1])
+            (_, signature, counter) = yubino.device.get_wrapped_assertion(self.device, app_id, challenge, credential_id)
+            print("signature: %s - counter: %d" % (signature.hex(), counter))
         except Exception as e:
             print("Operation failed: %s" % e)
 
@@ -114,6 +320,30 @@ class YubinoShell(cmd.Cmd):
         except Exception as e:
             print("Operation failed: %s" % e)
 
+    def do_device_list_credentials_page(self, arg):
+        """
+        List the credentials of the device <page_size> at a time, optionally only those
+        whose hashed app_id starts with the hexadecimal <prefix>.
+        device_list_credentials_page <page_size> <prefix>
+        """
+        args = shlex.split(arg)
+        if len(args) > 2 or len(args) == 0:
+            print("Usage: device_list_credentials_page <page_size> <prefix>")
+            return
+
+        try:
+            page_size = int(args[0])
+            prefix = bytes.fromhex(args[1]) if len(args) == 2 else b''
+            cursor = 0
+            page = 0
+            while cursor is not None:
+                (entries, cursor) = yubino.device.list_credentials_page(self.device, cursor, page_size, prefix)
+                page += 1
+                for entry in entries:
+                    print("page %d - hashed_app_id: %s - credential_id: %s" % (page, entry['hashed_app_id'].hex(), entry['credential_id'].hex()))
+        except Exception as e:
+            print("Operation failed: %s" % e)
+
 
     def do_EOF(self, line):
         """
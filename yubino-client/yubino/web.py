@@ -44,6 +44,8 @@ class Client:
             logging.error("Failed to generate a new credential: %s", e)
             return False
 
+        # 21 bytes if the device sends compressed keys, 40 otherwise: sent as is,
+        # the relying party has to accept the form the device was set to
         r = self.session.post(
                 f"{self.host}/register",
                 json={
@@ -69,7 +71,7 @@ class Client:
         logging.debug("Challenge is %s", data["challenge"])
 
         try:
-            credential_id, signature = yubino.device.get_assertion(self.device, data['app_id'], data['challenge'])
+            credential_id, signature, counter = yubino.device.get_assertion(self.device, data['app_id'], data['challenge'])
         except Exception as e:
             logging.error("Failed to get assertion: %s", e)
             return False
@@ -79,7 +81,8 @@ class Client:
                 json={
                     'name': username,
                     'credential_id': credential_id.hex(),
-                    'signature': signature.hex()
+                    'signature': signature.hex(),
+                    'counter': counter
                 })
 
         if r.status_code != requests.codes.okay: